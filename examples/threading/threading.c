@@ -2,12 +2,19 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <time.h>
 
 // Optional: use these functions to add debug or error prints to your application
 #define DEBUG_LOG(msg,...)
 //#define DEBUG_LOG(msg,...) printf("threading: " msg "\n" , ##__VA_ARGS__)
 #define ERROR_LOG(msg,...) printf("threading ERROR: " msg "\n" , ##__VA_ARGS__)
 
+/* Yields before a worker with nothing to run blocks instead of spinning */
+#define SPIN_LIMIT 64
+
 void* threadfunc(void* thread_param)
 {
 
@@ -38,6 +45,14 @@ void* threadfunc(void* thread_param)
     return thread_param;
 }
 
+static void init_thread_data(struct thread_data *arguments, pthread_mutex_t *mutex,
+                             int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    arguments->wait_to_obtain_ms = wait_to_obtain_ms;
+    arguments->wait_to_release_ms = wait_to_release_ms;
+    arguments->thread_complete_success = true;
+    arguments->mutex = mutex;
+}
 
 bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms)
 {
@@ -54,10 +69,7 @@ bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int
         ERROR_LOG("Error Allocating memory");
         return false;
     }
-    arguments->wait_to_obtain_ms = wait_to_obtain_ms;
-    arguments->wait_to_release_ms = wait_to_release_ms;
-    arguments->thread_complete_success = true;
-    arguments->mutex = mutex;
+    init_thread_data(arguments, mutex, wait_to_obtain_ms, wait_to_release_ms);
 
     int s = pthread_create(thread, NULL, threadfunc, (void*)arguments);
     if (s != 0) {
@@ -69,3 +81,485 @@ bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int
     return arguments->thread_complete_success;
 }
 
+
+/*
+ * Thread pool
+ *
+ * Every worker owns a ring buffer deque guarded by its own mutex.  The owner
+ * pushes and pops at the bottom (LIFO, cache friendly), thieves take from the
+ * top (FIFO, oldest work first).  The pool lock is only taken to sleep, to
+ * wake sleepers and to publish task completion.
+ */
+
+#define THREADPOOL_INITIAL_DEQUE_CAPACITY 64
+
+struct threadpool_task {
+    threadpool_func_t func;
+    void *arg;
+    void *result;
+    threadpool_callback_t callback;
+    void *callback_arg;
+    bool done;
+    struct threadpool *pool;
+    /* Argument block for threadpool_submit_obtaining_mutex() tasks */
+    struct thread_data data;
+    struct threadpool_task *next_free;
+};
+
+struct threadpool_worker {
+    pthread_t thread;
+    struct threadpool *pool;
+    int index;
+    pthread_mutex_t lock;
+    struct threadpool_task **tasks;
+    size_t capacity;
+    size_t head;
+    size_t count;
+};
+
+struct threadpool {
+    struct threadpool_worker *workers;
+    int num_workers;
+    int started_workers;
+    atomic_uint next_worker;
+    /* Tasks queued in any deque and not yet taken by a worker, counted
+     * before a task is published so it never drops below zero */
+    atomic_size_t pending;
+    atomic_int idle;
+    /* Workers blocked in threadpool_future_get(), woken for new work too */
+    atomic_int helpers;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    bool shutdown;
+    pthread_mutex_t free_lock;
+    struct threadpool_task *free_tasks;
+};
+
+static __thread struct threadpool_worker *current_worker;
+
+static struct threadpool_task *task_alloc(struct threadpool *pool)
+{
+    struct threadpool_task *task;
+
+    pthread_mutex_lock(&pool->free_lock);
+    task = pool->free_tasks;
+    if (task != NULL) {
+        pool->free_tasks = task->next_free;
+    }
+    pthread_mutex_unlock(&pool->free_lock);
+
+    if (task == NULL) {
+        task = malloc(sizeof(struct threadpool_task));
+        if (task == NULL) {
+            ERROR_LOG("Error Allocating memory");
+            return NULL;
+        }
+    }
+    memset(task, 0, sizeof(*task));
+    task->pool = pool;
+    return task;
+}
+
+static void task_free(struct threadpool_task *task)
+{
+    struct threadpool *pool = task->pool;
+
+    pthread_mutex_lock(&pool->free_lock);
+    task->next_free = pool->free_tasks;
+    pool->free_tasks = task;
+    pthread_mutex_unlock(&pool->free_lock);
+}
+
+static bool deque_push(struct threadpool_worker *worker, struct threadpool_task *task)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count == worker->capacity) {
+        size_t new_capacity = worker->capacity * 2;
+        struct threadpool_task **new_tasks = malloc(new_capacity * sizeof(*new_tasks));
+        if (new_tasks == NULL) {
+            pthread_mutex_unlock(&worker->lock);
+            ERROR_LOG("Error Allocating memory");
+            return false;
+        }
+        for (size_t i = 0; i < worker->count; i++) {
+            new_tasks[i] = worker->tasks[(worker->head + i) % worker->capacity];
+        }
+        free(worker->tasks);
+        worker->tasks = new_tasks;
+        worker->capacity = new_capacity;
+        worker->head = 0;
+    }
+    worker->tasks[(worker->head + worker->count) % worker->capacity] = task;
+    worker->count++;
+    pthread_mutex_unlock(&worker->lock);
+    return true;
+}
+
+/* Owner side: take the most recently pushed task */
+static struct threadpool_task *deque_pop_bottom(struct threadpool_worker *worker)
+{
+    struct threadpool_task *task = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->count > 0) {
+        worker->count--;
+        task = worker->tasks[(worker->head + worker->count) % worker->capacity];
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+}
+
+/* Thief side: take the oldest task */
+static struct threadpool_task *deque_steal_top(struct threadpool_worker *worker)
+{
+    struct threadpool_task *task = NULL;
+
+    if (pthread_mutex_trylock(&worker->lock) != 0) {
+        return NULL;
+    }
+    if (worker->count > 0) {
+        task = worker->tasks[worker->head];
+        worker->head = (worker->head + 1) % worker->capacity;
+        worker->count--;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return task;
+}
+
+static struct threadpool_task *find_task(struct threadpool_worker *worker)
+{
+    struct threadpool *pool = worker->pool;
+    struct threadpool_task *task = deque_pop_bottom(worker);
+
+    for (int i = 1; task == NULL && i < pool->num_workers; i++) {
+        task = deque_steal_top(&pool->workers[(worker->index + i) % pool->num_workers]);
+    }
+    if (task != NULL) {
+        atomic_fetch_sub(&pool->pending, 1);
+    }
+    return task;
+}
+
+static void wake_workers(struct threadpool *pool, size_t count)
+{
+    if (atomic_load(&pool->idle) == 0 && atomic_load(&pool->helpers) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (count == 1) {
+        pthread_cond_signal(&pool->work_cond);
+    } else {
+        pthread_cond_broadcast(&pool->work_cond);
+    }
+    if (atomic_load(&pool->helpers) > 0) {
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void run_task(struct threadpool_task *task)
+{
+    struct threadpool *pool = task->pool;
+
+    task->result = task->func(task->arg);
+
+    if (task->callback != NULL) {
+        task->callback(task->result, task->callback_arg);
+        task_free(task);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    task->done = true;
+    pthread_cond_broadcast(&pool->done_cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* worker_func(void* worker_param)
+{
+    struct threadpool_worker *worker = (struct threadpool_worker *) worker_param;
+    struct threadpool *pool = worker->pool;
+
+    current_worker = worker;
+
+    int spins = 0;
+    for (;;) {
+        struct threadpool_task *task = find_task(worker);
+        if (task != NULL) {
+            spins = 0;
+            run_task(task);
+            continue;
+        }
+
+        /*
+         * A task may be counted in pending while it is still being pushed
+         * or another worker is taking it; yield and retry for a while, then
+         * sleep briefly instead of spinning on it.
+         */
+        bool counted = atomic_load(&pool->pending) > 0;
+        if (counted && ++spins < SPIN_LIMIT) {
+            sched_yield();
+            continue;
+        }
+        spins = 0;
+
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->idle, 1);
+        if (counted) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += 1000000;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&pool->work_cond, &pool->lock, &until);
+        }
+        while (atomic_load(&pool->pending) == 0 && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        atomic_fetch_sub(&pool->idle, 1);
+        bool exit_worker = pool->shutdown && atomic_load(&pool->pending) == 0;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (exit_worker) {
+            break;
+        }
+    }
+
+    current_worker = NULL;
+    return NULL;
+}
+
+struct threadpool *threadpool_create(int num_workers)
+{
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+
+    struct threadpool *pool = calloc(1, sizeof(struct threadpool));
+    if (pool == NULL) {
+        ERROR_LOG("Error Allocating memory");
+        return NULL;
+    }
+    pool->workers = calloc(num_workers, sizeof(struct threadpool_worker));
+    if (pool->workers == NULL) {
+        ERROR_LOG("Error Allocating memory");
+        free(pool);
+        return NULL;
+    }
+    pool->num_workers = num_workers;
+    atomic_init(&pool->next_worker, 0);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->idle, 0);
+    atomic_init(&pool->helpers, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    pthread_mutex_init(&pool->free_lock, NULL);
+
+    for (int i = 0; i < num_workers; i++) {
+        struct threadpool_worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->capacity = THREADPOOL_INITIAL_DEQUE_CAPACITY;
+        worker->tasks = malloc(worker->capacity * sizeof(*worker->tasks));
+        if (worker->tasks == NULL) {
+            ERROR_LOG("Error Allocating memory");
+            threadpool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_func, &pool->workers[i]) != 0) {
+            ERROR_LOG("Error creating thread");
+            threadpool_destroy(pool);
+            return NULL;
+        }
+        pool->started_workers++;
+    }
+
+    return pool;
+}
+
+void threadpool_destroy(struct threadpool *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->started_workers; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        free(pool->workers[i].tasks);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+    free(pool->workers);
+
+    while (pool->free_tasks != NULL) {
+        struct threadpool_task *task = pool->free_tasks;
+        pool->free_tasks = task->next_free;
+        free(task);
+    }
+
+    pthread_mutex_destroy(&pool->free_lock);
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+static struct threadpool_worker *pick_worker(struct threadpool *pool)
+{
+    if (current_worker != NULL && current_worker->pool == pool) {
+        return current_worker;
+    }
+    return &pool->workers[atomic_fetch_add(&pool->next_worker, 1) % pool->num_workers];
+}
+
+static bool queue_task(struct threadpool *pool, struct threadpool_task *task)
+{
+    atomic_fetch_add(&pool->pending, 1);
+    if (!deque_push(pick_worker(pool), task)) {
+        atomic_fetch_sub(&pool->pending, 1);
+        task_free(task);
+        return false;
+    }
+    wake_workers(pool, 1);
+    return true;
+}
+
+struct threadpool_task *threadpool_submit(struct threadpool *pool, threadpool_func_t func, void *arg)
+{
+    struct threadpool_task *task = task_alloc(pool);
+    if (task == NULL) {
+        return NULL;
+    }
+    task->func = func;
+    task->arg = arg;
+
+    return queue_task(pool, task) ? task : NULL;
+}
+
+bool threadpool_submit_callback(struct threadpool *pool, threadpool_func_t func, void *arg,
+                                threadpool_callback_t callback, void *callback_arg)
+{
+    struct threadpool_task *task = task_alloc(pool);
+    if (task == NULL) {
+        return false;
+    }
+    task->func = func;
+    task->arg = arg;
+    task->callback = callback;
+    task->callback_arg = callback_arg;
+
+    return queue_task(pool, task);
+}
+
+int threadpool_submit_batch(struct threadpool *pool, threadpool_func_t func, void **args, int count,
+                            struct threadpool_task **futures)
+{
+    int queued = 0;
+
+    for (int i = 0; i < count; i++) {
+        struct threadpool_task *task = task_alloc(pool);
+        if (task == NULL) {
+            break;
+        }
+        task->func = func;
+        task->arg = args[i];
+        struct threadpool_worker *worker =
+            &pool->workers[atomic_fetch_add(&pool->next_worker, 1) % pool->num_workers];
+        atomic_fetch_add(&pool->pending, 1);
+        if (!deque_push(worker, task)) {
+            atomic_fetch_sub(&pool->pending, 1);
+            task_free(task);
+            break;
+        }
+        if (futures != NULL) {
+            futures[i] = task;
+        }
+        queued++;
+    }
+
+    if (queued > 0) {
+        wake_workers(pool, queued);
+    }
+    return queued;
+}
+
+void *threadpool_future_get(struct threadpool_task *task)
+{
+    struct threadpool *pool = task->pool;
+
+    /*
+     * A worker waiting on a future keeps running queued tasks, otherwise
+     * tasks waiting on subtasks could block every worker in the pool. When
+     * nothing is queued it sleeps until the task finishes or new work is
+     * submitted, rather than spinning while another worker runs the task.
+     */
+    if (current_worker != NULL && current_worker->pool == pool) {
+        int spins = 0;
+        pthread_mutex_lock(&pool->lock);
+        while (!task->done) {
+            pthread_mutex_unlock(&pool->lock);
+            struct threadpool_task *other = find_task(current_worker);
+            if (other != NULL) {
+                spins = 0;
+                run_task(other);
+            } else if (++spins < SPIN_LIMIT) {
+                sched_yield();
+            }
+            pthread_mutex_lock(&pool->lock);
+            if (other == NULL && spins >= SPIN_LIMIT && !task->done) {
+                spins = 0;
+                atomic_fetch_add(&pool->helpers, 1);
+                if (atomic_load(&pool->pending) == 0) {
+                    pthread_cond_wait(&pool->done_cond, &pool->lock);
+                }
+                atomic_fetch_sub(&pool->helpers, 1);
+            }
+        }
+        pthread_mutex_unlock(&pool->lock);
+        return task->result;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (!task->done) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return task->result;
+}
+
+void threadpool_future_release(struct threadpool_task *task)
+{
+    if (task != NULL) {
+        task_free(task);
+    }
+}
+
+struct threadpool_task *threadpool_submit_obtaining_mutex(struct threadpool *pool, pthread_mutex_t *mutex,
+                                                          int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    struct threadpool_task *task = task_alloc(pool);
+    if (task == NULL) {
+        return NULL;
+    }
+    init_thread_data(&task->data, mutex, wait_to_obtain_ms, wait_to_release_ms);
+    task->func = threadfunc;
+    task->arg = &task->data;
+
+    return queue_task(pool, task) ? task : NULL;
+}
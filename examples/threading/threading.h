@@ -41,3 +41,97 @@ struct thread_data{
 * @return true if the thread could be started, false if a failure occurred.
 */
 bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms);
+
+/**
+ * Entry point for a task run by a threadpool worker.  The value returned is
+ * stored as the task result and handed to the completion callback or to
+ * threadpool_future_get().
+ */
+typedef void *(*threadpool_func_t)(void *arg);
+
+/**
+ * Completion callback for tasks submitted with threadpool_submit_callback().
+ * Runs on the worker thread which executed the task, with @param result set
+ * to the value returned by the task function.
+ */
+typedef void (*threadpool_callback_t)(void *result, void *callback_arg);
+
+/**
+ * Fixed-size pool of worker threads.  Each worker owns a deque of tasks: it
+ * pushes and pops work at the bottom of its own deque and steals from the top
+ * of other workers' deques when its own runs dry.
+ */
+struct threadpool;
+
+/**
+ * Task descriptor, doubling as the future for the task.  Descriptors are
+ * recycled by the pool instead of being allocated per task.
+ */
+struct threadpool_task;
+
+/**
+* Create a pool with @param num_workers worker threads (at least one).
+* @return the pool, or NULL if memory or threads could not be allocated.
+*/
+struct threadpool *threadpool_create(int num_workers);
+
+/**
+* Run every task already submitted to @param pool, then stop and join the
+* workers and free the pool.  Only recycled descriptors are freed: release
+* every future with threadpool_future_release() before calling this function.
+*/
+void threadpool_destroy(struct threadpool *pool);
+
+/**
+* Queue @param func to run with @param arg on one of the pool workers.
+* When called from a worker thread the task is pushed on that worker's own
+* deque, otherwise workers are picked round robin.
+* @return the future for the task, to be passed to threadpool_future_get() and
+* threadpool_future_release(), or NULL if the task could not be queued.
+*/
+struct threadpool_task *threadpool_submit(struct threadpool *pool, threadpool_func_t func, void *arg);
+
+/**
+* Queue @param func like threadpool_submit(), but call @param callback with the
+* task result when it completes instead of returning a future.  The task
+* descriptor is recycled once the callback returns.
+* @return true if the task was queued.
+*/
+bool threadpool_submit_callback(struct threadpool *pool, threadpool_func_t func, void *arg,
+                                threadpool_callback_t callback, void *callback_arg);
+
+/**
+* Queue @param count tasks running @param func, one per entry of @param args,
+* spreading them across the worker deques and waking workers only once.
+* If @param futures is not NULL it receives one future per queued task.
+* @return the number of tasks queued, which is less than @param count only if
+* task descriptors could not be allocated.
+*/
+int threadpool_submit_batch(struct threadpool *pool, threadpool_func_t func, void **args, int count,
+                            struct threadpool_task **futures);
+
+/**
+* Block until the task behind @param task has run.  When called from a pool
+* worker, other queued tasks are run while waiting.
+* @return the value returned by the task function.
+*/
+void *threadpool_future_get(struct threadpool_task *task);
+
+/**
+* Return @param task to the pool descriptor cache.  The future must not be
+* used afterwards, and any result pointing into it (see
+* threadpool_submit_obtaining_mutex()) becomes invalid.
+*/
+void threadpool_future_release(struct threadpool_task *task);
+
+/**
+* Pool counterpart of start_thread_obtaining_mutex(): queue a task which
+* sleeps @param wait_to_obtain_ms, obtains @param mutex, holds it for
+* @param wait_to_release_ms and releases it.  The thread_data structure lives
+* in the pooled task descriptor rather than being allocated for each call.
+* threadpool_future_get() returns a pointer to it so the caller can check
+* thread_complete_success; it stays valid until threadpool_future_release().
+* @return the future for the task, or NULL if it could not be queued.
+*/
+struct threadpool_task *threadpool_submit_obtaining_mutex(struct threadpool *pool, pthread_mutex_t *mutex,
+                                                          int wait_to_obtain_ms, int wait_to_release_ms);
@@ -0,0 +1,780 @@
+/*
+ * Stress and replay harness for aesdsocket.
+ *
+ * Replays a recorded trace, or generated traffic, from many concurrent
+ * clients and checks the log invariants the server must keep:
+ *  - every line of the final log is a whole packet or a timestamp, so no
+ *    packet was torn or interleaved with another one,
+ *  - every packet sent appears exactly once, in per-client send order,
+ *  - every reply ends on a packet boundary, contains the packet it answers
+ *    and is a prefix of the final log,
+ *  - a packet sent after another packet's reply was received comes after
+ *    that packet in the log, whichever clients sent them,
+ *  - with -T, timestamp lines are present.
+ * Throughput is reported on every run.
+ *
+ * Packets are tagged "c<client>-<seq>-" so they can be matched in the log.
+ * Trace files hold one packet per line as "<client> <payload>".
+ */
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lz4block.h"
+
+#define COMPRESS_CMD "AESDSOCKET_COMPRESS:lz4\n"
+#define FRAME_HEADER_SIZE 8
+#define TIMESTAMP_PREFIX "timestamp:"
+#define TIMESTAMP_INTERVAL_S 10
+
+struct buffer {
+  char *data;
+  size_t len;
+  size_t size;
+};
+
+/* Length and hash of a reply, checked against the final log at the end */
+struct reply_check {
+  size_t len;
+  uint64_t hash;
+};
+
+struct client {
+  int id;
+  pthread_t thread;
+  char **packets;
+  size_t *packet_lens;
+  size_t count;
+  size_t capacity;
+  struct reply_check *replies;
+  size_t replies_count;
+  /* When each packet started to be sent and when its reply was complete */
+  double *sent_at;
+  double *replied_at;
+  uint64_t reply_bytes;
+  unsigned int seed;
+  int failed;
+  /* Index of the next packet expected in the final log */
+  size_t next_seen;
+};
+
+static const char *host = "127.0.0.1";
+static int port = 9000;
+static const char *unix_path = NULL;
+static int compressed = 0;
+static int max_fragment = 0;
+static int idle_ms = 0;
+static int gap_ms = 0;
+static struct client *clients = NULL;
+static int num_clients = 0;
+
+/* Client and packet index of every packet line, in final log order */
+struct log_packet {
+  int id;
+  size_t seq;
+};
+
+static uint64_t fnv1a(uint64_t hash, const char *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+
+static double now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int buffer_reserve(struct buffer *buf, size_t len) {
+  if (buf->len + len > buf->size) {
+    size_t new_size = buf->size == 0 ? 4096 : buf->size;
+    while (new_size < buf->len + len)
+      new_size *= 2;
+    char *new_data = realloc(buf->data, new_size);
+    if (new_data == NULL)
+      return -1;
+    buf->data = new_data;
+    buf->size = new_size;
+  }
+  return 0;
+}
+
+static int buffer_append(struct buffer *buf, const char *data, size_t len) {
+  if (buffer_reserve(buf, len) == -1)
+    return -1;
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return 0;
+}
+
+static int add_packet(struct client *c, const char *payload) {
+  if (c->count == c->capacity) {
+    size_t new_capacity = c->capacity == 0 ? 64 : c->capacity * 2;
+    char **packets = realloc(c->packets, new_capacity * sizeof(*packets));
+    size_t *lens = realloc(c->packet_lens, new_capacity * sizeof(*lens));
+    if (packets == NULL || lens == NULL) {
+      free(packets);
+      free(lens);
+      return -1;
+    }
+    c->packets = packets;
+    c->packet_lens = lens;
+    c->capacity = new_capacity;
+  }
+
+  int len = asprintf(&c->packets[c->count], "c%d-%zu-%s\n", c->id, c->count,
+                     payload);
+  if (len == -1)
+    return -1;
+  c->packet_lens[c->count++] = len;
+  return 0;
+}
+
+static struct client *get_client(int id) {
+  if (id >= num_clients) {
+    struct client *new_clients = realloc(clients, (id + 1) * sizeof(*clients));
+    if (new_clients == NULL)
+      return NULL;
+    memset(new_clients + num_clients, 0,
+           (id + 1 - num_clients) * sizeof(*clients));
+    for (int i = num_clients; i <= id; i++)
+      new_clients[i].id = i;
+    clients = new_clients;
+    num_clients = id + 1;
+  }
+  return &clients[id];
+}
+
+/**
+ * Load a trace, giving each of its clients scale replicas
+ */
+static int load_trace(const char *path, int scale) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  int ret = 0;
+  while ((len = getline(&line, &line_size, f)) != -1) {
+    if (len > 0 && line[len - 1] == '\n')
+      line[len - 1] = '\0';
+    char *payload;
+    long id = strtol(line, &payload, 10);
+    if (payload == line || id < 0 || *payload != ' ') {
+      fprintf(stderr, "Malformed trace line: %s\n", line);
+      ret = -1;
+      break;
+    }
+    payload++;
+    for (int r = 0; r < scale; r++) {
+      struct client *c = get_client(id * scale + r);
+      if (c == NULL || add_packet(c, payload) == -1) {
+        ret = -1;
+        break;
+      }
+    }
+  }
+
+  free(line);
+  fclose(f);
+  return ret;
+}
+
+static int generate_traffic(int count, int packets, int size) {
+  char *payload = malloc(size + 1);
+  if (payload == NULL)
+    return -1;
+
+  for (int id = 0; id < count; id++) {
+    struct client *c = get_client(id);
+    if (c == NULL)
+      return -1;
+    for (int p = 0; p < packets; p++) {
+      for (int i = 0; i < size; i++)
+        payload[i] = 'a' + (id + p + i) % 26;
+      payload[size] = '\0';
+      if (add_packet(c, payload) == -1)
+        return -1;
+    }
+  }
+
+  free(payload);
+  return 0;
+}
+
+static int connect_server(void) {
+  int fd;
+
+  if (unix_path != NULL) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+      return fd;
+  } else {
+    struct addrinfo hints = {.ai_socktype = SOCK_STREAM};
+    struct addrinfo *res;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0)
+      return -1;
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd != -1 && connect(fd, res->ai_addr, res->ai_addrlen) == 0) {
+      /* Let fragments from -f reach the server as separate segments */
+      int nodelay = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+      freeaddrinfo(res);
+      return fd;
+    }
+    freeaddrinfo(res);
+  }
+
+  perror("connect");
+  if (fd != -1)
+    close(fd);
+  return -1;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L};
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+    ;
+}
+
+/**
+ * Send a packet, split in random fragments when -f is given so the server
+ * has to reassemble it across reads.  With -g the fragments are spaced out
+ * so a packet takes several reads even on a fast link.
+ */
+static int send_packet(struct client *c, int fd, const char *data, size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    size_t chunk = len - sent;
+    if (max_fragment > 0) {
+      size_t max = 1 + rand_r(&c->seed) % max_fragment;
+      if (chunk > max)
+        chunk = max;
+    }
+    ssize_t n = send(fd, data + sent, chunk, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("send");
+      return -1;
+    }
+    sent += n;
+    if (gap_ms > 0 && sent < len)
+      sleep_ms(gap_ms);
+  }
+  return 0;
+}
+
+static int recv_exact(int fd, char *data, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = recv(fd, data + got, len - got, 0);
+    if (n == 0)
+      return -1;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    got += n;
+  }
+  return 0;
+}
+
+/**
+ * Read one compressed reply, up to its end marker, into reply
+ */
+static int recv_compressed_reply(int fd, struct buffer *reply) {
+  char *payload = NULL;
+  size_t payload_size = 0;
+  int ret = -1;
+
+  reply->len = 0;
+  for (;;) {
+    uint32_t header[2];
+    if (recv_exact(fd, (char *)header, FRAME_HEADER_SIZE) == -1)
+      break;
+    size_t raw_len = ntohl(header[0]);
+    size_t len = ntohl(header[1]);
+    if (raw_len == 0 && len == 0) {
+      ret = 0;
+      break;
+    }
+
+    if (len > payload_size) {
+      char *new_payload = realloc(payload, len);
+      if (new_payload == NULL)
+        break;
+      payload = new_payload;
+      payload_size = len;
+    }
+    if (recv_exact(fd, payload, len) == -1)
+      break;
+
+    if (raw_len == len) {
+      if (buffer_append(reply, payload, len) == -1)
+        break;
+      continue;
+    }
+
+    /* Make room for the decompressed block, then fill it in place */
+    size_t offset = reply->len;
+    if (buffer_reserve(reply, raw_len) == -1 ||
+        lz4block_decompress(payload, len, reply->data + offset, raw_len) !=
+            (long)raw_len) {
+      fprintf(stderr, "Malformed compressed frame\n");
+      break;
+    }
+    reply->len = offset + raw_len;
+  }
+
+  free(payload);
+  return ret;
+}
+
+/**
+ * Read a plain reply until the server closes the connection
+ */
+static int recv_plain_reply(int fd, struct buffer *reply) {
+  char chunk[65536];
+  ssize_t n;
+
+  reply->len = 0;
+  while ((n = recv(fd, chunk, sizeof(chunk), 0)) != 0) {
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("recv");
+      return -1;
+    }
+    if (buffer_append(reply, chunk, n) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+static int contains_line(const struct buffer *reply, const char *line,
+                         size_t len) {
+  const char *p = reply->data;
+  const char *end = reply->data + reply->len;
+
+  while (p < end) {
+    const char *nl = memchr(p, '\n', end - p);
+    if (nl == NULL)
+      return 0;
+    if ((size_t)(nl + 1 - p) == len && memcmp(p, line, len) == 0)
+      return 1;
+    p = nl + 1;
+  }
+  return 0;
+}
+
+static int check_reply(struct client *c, size_t index,
+                       const struct buffer *reply) {
+  if (reply->len == 0 || reply->data[reply->len - 1] != '\n') {
+    fprintf(stderr, "client %d packet %zu: reply ends mid packet\n", c->id,
+            index);
+    return -1;
+  }
+  if (!contains_line(reply, c->packets[index], c->packet_lens[index])) {
+    fprintf(stderr, "client %d packet %zu: reply is missing the packet\n",
+            c->id, index);
+    return -1;
+  }
+
+  struct reply_check *check = &c->replies[c->replies_count++];
+  check->len = reply->len;
+  check->hash = fnv1a(FNV_OFFSET, reply->data, reply->len);
+  c->reply_bytes += reply->len;
+  return 0;
+}
+
+static void *client_func(void *param) {
+  struct client *c = (struct client *)param;
+  struct buffer reply = {0};
+  int fd = -1;
+
+  c->replies = calloc(c->count, sizeof(*c->replies));
+  c->sent_at = calloc(c->count, sizeof(*c->sent_at));
+  c->replied_at = calloc(c->count, sizeof(*c->replied_at));
+  if (c->replies == NULL || c->sent_at == NULL || c->replied_at == NULL) {
+    c->failed = 1;
+    return NULL;
+  }
+
+  if (compressed) {
+    /* One connection for all packets, replies are framed */
+    fd = connect_server();
+    if (fd == -1 || send_packet(c, fd, COMPRESS_CMD, strlen(COMPRESS_CMD)) ||
+        recv_compressed_reply(fd, &reply) == -1) {
+      c->failed = 1;
+      goto out;
+    }
+  }
+
+  for (size_t i = 0; i < c->count; i++) {
+    if (!compressed) {
+      /* One connection per packet, the reply ends when the server closes */
+      fd = connect_server();
+      if (fd == -1) {
+        c->failed = 1;
+        break;
+      }
+    }
+
+    /* Let the connection sit idle first, a packet must restart the timer */
+    if (idle_ms > 0)
+      sleep_ms(idle_ms);
+    c->sent_at[i] = now_s();
+    if (send_packet(c, fd, c->packets[i], c->packet_lens[i]) == -1) {
+      c->failed = 1;
+      break;
+    }
+
+    int s;
+    if (compressed) {
+      s = recv_compressed_reply(fd, &reply);
+    } else {
+      shutdown(fd, SHUT_WR);
+      s = recv_plain_reply(fd, &reply);
+      close(fd);
+      fd = -1;
+    }
+    c->replied_at[i] = now_s();
+    if (s == -1 || check_reply(c, i, &reply) == -1) {
+      c->failed = 1;
+      break;
+    }
+  }
+
+out:
+  if (fd != -1)
+    close(fd);
+  free(reply.data);
+  return NULL;
+}
+
+/**
+ * Fetch the final log with a marker packet after all clients are done
+ */
+static int fetch_final_log(struct buffer *log) {
+  char marker[64];
+  int len = snprintf(marker, sizeof(marker), "stress-end-%d\n", getpid());
+  struct client dummy = {.seed = 1};
+
+  int fd = connect_server();
+  if (fd == -1)
+    return -1;
+  int s = send_packet(&dummy, fd, marker, len);
+  shutdown(fd, SHUT_WR);
+  if (s == 0)
+    s = recv_plain_reply(fd, log);
+  close(fd);
+
+  if (s == 0 && (log->len < (size_t)len ||
+                 memcmp(log->data + log->len - len, marker, len) != 0)) {
+    fprintf(stderr, "final log does not end with the marker packet\n");
+    return -1;
+  }
+  if (s == 0)
+    log->len -= len;
+  return s;
+}
+
+static int compare_checks(const void *a, const void *b) {
+  const struct reply_check *x = a;
+  const struct reply_check *y = b;
+  return x->len < y->len ? -1 : x->len > y->len;
+}
+
+/**
+ * Check every line of the final log, then every reply against it
+ */
+static int check_final_log(const struct buffer *log, int want_timestamps) {
+  const char *p = log->data;
+  const char *end = log->data + log->len;
+  size_t timestamps = 0;
+  size_t boundaries = 0;
+  int errors = 0;
+
+  /* Hash of every prefix ending on a line boundary */
+  struct reply_check *prefixes = NULL;
+  size_t prefixes_size = 0;
+  uint64_t hash = FNV_OFFSET;
+
+  struct log_packet *order = NULL;
+  size_t order_count = 0;
+  size_t total = 0;
+  for (int id = 0; id < num_clients; id++)
+    total += clients[id].count;
+  order = malloc((total > 0 ? total : 1) * sizeof(*order));
+  if (order == NULL)
+    return -1;
+
+  while (p < end && errors < 10) {
+    const char *nl = memchr(p, '\n', end - p);
+    if (nl == NULL) {
+      fprintf(stderr, "final log ends mid packet\n");
+      errors++;
+      break;
+    }
+    size_t len = nl + 1 - p;
+
+    int id;
+    size_t seq;
+    if (len > strlen(TIMESTAMP_PREFIX) + 1 &&
+        memcmp(p, TIMESTAMP_PREFIX, strlen(TIMESTAMP_PREFIX)) == 0) {
+      timestamps++;
+    } else if (sscanf(p, "c%d-%zu-", &id, &seq) == 2 && id >= 0 &&
+               id < num_clients && seq < clients[id].count &&
+               clients[id].packet_lens[seq] == len &&
+               memcmp(clients[id].packets[seq], p, len) == 0) {
+      if (seq != clients[id].next_seen) {
+        fprintf(stderr, "client %d packet %zu out of order or duplicated\n",
+                id, seq);
+        errors++;
+      }
+      clients[id].next_seen = seq + 1;
+      if (order_count < total)
+        order[order_count++] = (struct log_packet){id, seq};
+    } else {
+      fprintf(stderr, "torn or unknown line at offset %zu: %.*s",
+              (size_t)(p - log->data), (int)(len > 80 ? 80 : len), p);
+      if (len > 80)
+        fputc('\n', stderr);
+      errors++;
+    }
+
+    hash = fnv1a(hash, p, len);
+    if (boundaries == prefixes_size) {
+      prefixes_size = prefixes_size == 0 ? 1024 : prefixes_size * 2;
+      struct reply_check *n = realloc(prefixes, prefixes_size * sizeof(*n));
+      if (n == NULL) {
+        free(prefixes);
+        free(order);
+        return -1;
+      }
+      prefixes = n;
+    }
+    prefixes[boundaries].len = nl + 1 - log->data;
+    prefixes[boundaries++].hash = hash;
+    p = nl + 1;
+  }
+
+  for (int id = 0; id < num_clients && errors < 10; id++) {
+    struct client *c = &clients[id];
+    if (!c->failed && c->next_seen != c->count) {
+      fprintf(stderr, "client %d: only %zu of %zu packets in the log\n", id,
+              c->next_seen, c->count);
+      errors++;
+    }
+    for (size_t i = 0; i < c->replies_count; i++) {
+      struct reply_check *found =
+          bsearch(&c->replies[i], prefixes, boundaries, sizeof(*prefixes),
+                  compare_checks);
+      if (found == NULL || found->hash != c->replies[i].hash) {
+        fprintf(stderr, "client %d packet %zu: reply is not a log prefix\n",
+                id, i);
+        errors++;
+        break;
+      }
+    }
+  }
+
+  /*
+   * Global order: walking the log backwards, keep the earliest reply of any
+   * later packet. If that reply arrived before this packet was even sent,
+   * the server put a newer packet ahead of an older one.
+   */
+  double first_later_reply = 0;
+  int seen_reply = 0;
+  for (size_t k = order_count; k-- > 0 && errors < 10;) {
+    struct client *c = &clients[order[k].id];
+    size_t seq = order[k].seq;
+    if (seq >= c->replies_count)
+      continue;
+    if (seen_reply && first_later_reply < c->sent_at[seq]) {
+      fprintf(stderr,
+              "client %d packet %zu: logged after a packet whose reply "
+              "arrived before it was sent\n",
+              c->id, seq);
+      errors++;
+    }
+    if (!seen_reply || c->replied_at[seq] < first_later_reply)
+      first_later_reply = c->replied_at[seq];
+    seen_reply = 1;
+  }
+
+  if (want_timestamps && timestamps == 0) {
+    fprintf(stderr, "no timestamp lines in the log\n");
+    errors++;
+  }
+
+  printf("log: %zu bytes, %zu lines, %zu timestamps\n", log->len, boundaries,
+         timestamps);
+  free(prefixes);
+  free(order);
+  return errors == 0 ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-H host] [-p port] [-u unix_path] [-c clients] "
+          "[-n packets] [-s size] [-t trace] [-x scale] [-f max_fragment] "
+          "[-i idle_ms] [-g gap_ms] [-I idle_connections] [-z] [-T]\n",
+          prog);
+}
+
+int main(int argc, char *argv[]) {
+  int count = 8;
+  int packets = 50;
+  int size = 64;
+  int scale = 1;
+  const char *trace = NULL;
+  int want_timestamps = 0;
+  int idle_connections = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "H:p:u:c:n:s:t:x:f:i:g:I:zT")) != -1) {
+    switch (opt) {
+    case 'H':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'u':
+      unix_path = optarg;
+      break;
+    case 'c':
+      count = atoi(optarg);
+      break;
+    case 'n':
+      packets = atoi(optarg);
+      break;
+    case 's':
+      size = atoi(optarg);
+      break;
+    case 't':
+      trace = optarg;
+      break;
+    case 'x':
+      scale = atoi(optarg);
+      break;
+    case 'f':
+      max_fragment = atoi(optarg);
+      break;
+    case 'i':
+      idle_ms = atoi(optarg);
+      break;
+    case 'g':
+      gap_ms = atoi(optarg);
+      break;
+    case 'I':
+      idle_connections = atoi(optarg);
+      break;
+    case 'z':
+      compressed = 1;
+      break;
+    case 'T':
+      want_timestamps = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (count < 1 || packets < 1 || size < 0 || scale < 1 || idle_ms < 0 ||
+      gap_ms < 0 || idle_connections < 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if ((trace != NULL ? load_trace(trace, scale)
+                     : generate_traffic(count * scale, packets, size)) == -1) {
+    fprintf(stderr, "Failed to prepare traffic\n");
+    return 2;
+  }
+
+  /* Connections that stay open without sending, so the server has many
+   * registered clients while only a few are active */
+  int *idle_fds = calloc(idle_connections > 0 ? idle_connections : 1,
+                         sizeof(*idle_fds));
+  if (idle_fds == NULL)
+    return 2;
+  for (int i = 0; i < idle_connections; i++) {
+    idle_fds[i] = connect_server();
+    if (idle_fds[i] == -1) {
+      fprintf(stderr, "Failed to open idle connection %d\n", i);
+      return 2;
+    }
+  }
+
+  size_t total_packets = 0;
+  double start = now_s();
+  for (int i = 0; i < num_clients; i++) {
+    clients[i].seed = i + 1;
+    total_packets += clients[i].count;
+    if (pthread_create(&clients[i].thread, NULL, client_func, &clients[i]) !=
+        0) {
+      fprintf(stderr, "Failed to create client thread\n");
+      return 2;
+    }
+  }
+
+  int failed = 0;
+  uint64_t reply_bytes = 0;
+  for (int i = 0; i < num_clients; i++) {
+    pthread_join(clients[i].thread, NULL);
+    failed |= clients[i].failed;
+    reply_bytes += clients[i].reply_bytes;
+  }
+  double elapsed = now_s() - start;
+
+  printf("%d clients, %zu packets in %.3f s: %.0f packets/s, %.1f MB/s of "
+         "replies\n",
+         num_clients, total_packets, elapsed, total_packets / elapsed,
+         reply_bytes / elapsed / 1e6);
+
+  /* Give the timestamp thread time to write at least once */
+  if (want_timestamps && elapsed < TIMESTAMP_INTERVAL_S + 1)
+    sleep(TIMESTAMP_INTERVAL_S + 1 - (int)elapsed);
+
+  struct buffer log = {0};
+  if (fetch_final_log(&log) == -1 ||
+      check_final_log(&log, want_timestamps) == -1)
+    failed = 1;
+  free(log.data);
+
+  for (int i = 0; i < idle_connections; i++)
+    close(idle_fds[i]);
+  free(idle_fds);
+
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+  return failed ? 1 : 0;
+}
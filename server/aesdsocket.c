@@ -1,38 +1,255 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/sockios.h>
+#include <malloc.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <syslog.h>
 #include <time.h>
 #include <unistd.h>
 
-#define PORT 9000
+#include "lz4block.h"
+
+#define DEFAULT_LISTENER "tcp:9000"
+#define MAX_LISTENERS 8
+#define PEER_NAME_SIZE 128
 #define DATA_FILE "/var/tmp/aesdsocketdata"
+#define INDEX_FILE DATA_FILE ".idx"
 #define BUFFER_SIZE 1024
 
-static volatile sig_atomic_t caught_signal = 0;
-static int server_fd = -1;
+/* Packet switching a connection to LZ4 compressed replies */
+#define COMPRESS_CMD "AESDSOCKET_COMPRESS:lz4\n"
+#define COMPRESS_BLOCK_SIZE 65536
+#define DEFAULT_FRAME_CACHE (16 * 1024 * 1024)
+#define FRAME_HEADER_SIZE 8
+
+/* Connection management defaults, see struct conn_config */
+#define DEFAULT_IDLE_TIMEOUT_S 300
+#define DEFAULT_READ_TIMEOUT_S 60
+#define DEFAULT_SEND_TIMEOUT_S 30
+#define DEFAULT_KEEPALIVE_IDLE_S 60
+#define KEEPALIVE_INTERVAL_S 10
+#define KEEPALIVE_COUNT 5
+#define DEFAULT_NOTSENT_LOWAT (128 * 1024)
+/* A send returns once the unsent bytes drop under the low-water mark, so
+ * a healthy client can have that much of a reply unsent at any time */
+#define DEFAULT_MAX_QUEUED DEFAULT_NOTSENT_LOWAT
+#define BACKLOG_POLL_MS 50
+#define DEFAULT_MAX_PACKET (16 * 1024 * 1024)
+#define REAP_INTERVAL_MS 1000
+
+/* Buffers of a whole huge page or more are mapped directly so they can be
+ * backed by huge pages. A reply reads the log through a heap chunk, or
+ * through one huge page once the log passes half of one. */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define HUGE_BUFFER_THRESHOLD HUGE_PAGE_SIZE
+#define REPLY_BUFFER_MAX HUGE_PAGE_SIZE
+#define REPLY_CHUNK_SIZE (64 * 1024)
+#define SPARE_HUGE_BUFFERS 16
+#define SPARE_NODES 8
+
+#define INDEX_MAGIC 0x61657364 /* "aesd" */
+#define INDEX_VERSION 1
+
+/* Lock-free atomic: written by the signal handler, polled by every thread */
+static atomic_int caught_signal = 0;
+
+/*
+ * Endpoint the server accepts connections on, configured with -l as
+ * tcp:PORT, tcp6:PORT or unix:PATH. Defaults to tcp:9000.
+ */
+struct listener {
+  int fd;
+  int family;
+  int port;
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  int bound; /* path was created by our bind and is ours to unlink */
+};
+
+static struct listener listeners[MAX_LISTENERS];
+static int num_listeners = 0;
+static int persist_mode = 0;
 static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Per-connection limits and socket tuning. A value of 0 disables the
+ * corresponding timeout or limit, or leaves the kernel default in place.
+ */
+struct conn_config {
+  int idle_timeout_ms;   /* no data between complete packets */
+  int read_timeout_ms;   /* partial packet left incomplete */
+  int send_timeout_ms;   /* reply making no progress */
+  int keepalive_idle_s;  /* TCP keepalive probes after this much silence */
+  int sndbuf;            /* SO_SNDBUF */
+  int notsent_lowat;     /* TCP_NOTSENT_LOWAT */
+  size_t max_queued;     /* unsent reply bytes before a reply waits */
+  size_t max_packet;     /* receive buffer bytes without a newline */
+};
+
+/*
+ * CPU placement of the server threads. Roles without a configured set keep
+ * the affinity the process was started with.
+ */
+struct cpu_placement {
+  cpu_set_t startup;
+  cpu_set_t accept;
+  cpu_set_t workers;
+  cpu_set_t timestamp;
+  int accept_set;
+  int workers_set;
+  int timestamp_set;
+};
+
+static struct cpu_placement cpu_placement;
+static int huge_pages = 0;
+
+static struct conn_config conn_config = {
+    .idle_timeout_ms = DEFAULT_IDLE_TIMEOUT_S * 1000,
+    .read_timeout_ms = DEFAULT_READ_TIMEOUT_S * 1000,
+    .send_timeout_ms = DEFAULT_SEND_TIMEOUT_S * 1000,
+    .keepalive_idle_s = DEFAULT_KEEPALIVE_IDLE_S,
+    .sndbuf = 0,
+    .notsent_lowat = DEFAULT_NOTSENT_LOWAT,
+    .max_queued = DEFAULT_MAX_QUEUED,
+    .max_packet = DEFAULT_MAX_PACKET,
+};
+
+/* Size and packet count of DATA_FILE, protected by file_mutex */
+static off_t log_size = 0;
+static uint64_t log_packets = 0;
+
+/* DATA_FILE opened once for appending and reading, so flushes and replies
+ * don't look the path up every time. Opened under file_mutex, closed on
+ * exit once every connection is done with it. */
+static int log_fd = -1;
+
+/*
+ * Sharded write path. Every connection (and the timestamp thread) appends
+ * packets to its own shard, so writers never contend with each other. Each
+ * packet is stamped with a global sequence number taken with an atomic
+ * fetch-add, which fixes its position in the log exactly like acquiring
+ * file_mutex used to. Readers merge the shards into DATA_FILE in sequence
+ * order under file_mutex before taking their snapshot (flush_log()).
+ *
+ * A shard that goes from empty to holding entries pushes itself on a
+ * lock-free stack of dirty shards, and a flush only visits the shards it
+ * pops from there. Its cost follows the connections that sent packets
+ * since the last flush, not every connection open. Writers scale with
+ * cores; every reply still takes file_mutex for its merge and snapshot.
+ */
+struct log_entry {
+  uint64_t seq;
+  size_t len;
+  STAILQ_ENTRY(log_entry) entries;
+  char data[];
+};
+
+STAILQ_HEAD(log_entry_list, log_entry);
+
+struct log_shard {
+  pthread_mutex_t lock;
+  struct log_entry_list entries;
+  int dirty; /* on dirty_shards, protected by lock */
+  struct log_shard *next_dirty;
+};
+
+static atomic_uint_least64_t next_seq = 0;
+
+/* Shards with entries not merged yet. Writers push one shard at a time and
+ * flush_log() takes the whole stack at once, so there is no ABA problem.
+ * Lock order is file_mutex, then a shard lock. */
+static _Atomic(struct log_shard *) dirty_shards = NULL;
+
+/* Merge state, protected by file_mutex: the next sequence number to write
+ * and entries drained from shards which are still waiting on a gap */
+static uint64_t committed_seq = 0;
+static struct log_entry_list pending_entries =
+    STAILQ_HEAD_INITIALIZER(pending_entries);
+
+/*
+ * Checkpoint written next to DATA_FILE on shutdown in persistent mode. It
+ * records how much of the log is known to hold complete packets so startup
+ * only has to validate what was appended after it.
+ */
+struct log_index {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t inode;
+  uint64_t size;
+  uint64_t packets;
+};
+
 struct thread_data {
   pthread_t thread_id;
   int client_fd;
-  char client_ip[INET_ADDRSTRLEN];
-  int thread_complete_flag;
+  char client_ip[PEER_NAME_SIZE];
+  atomic_int thread_complete_flag; /* Set by the thread, read by main */
   SLIST_ENTRY(thread_data) entries;
 };
 
 static SLIST_HEAD(thread_head, thread_data) head;
 
+/*
+ * Compressed reply frame: 4 byte big endian raw length, 4 byte big endian
+ * payload length, then the payload. The payload is an LZ4 block, or the raw
+ * bytes when both lengths are equal. A reply ends with an all-zero header.
+ */
+struct reply_frame {
+  int refs;
+  off_t raw_len;
+  size_t len;
+  char data[];
+};
+
+/*
+ * Frames of complete COMPRESS_BLOCK_SIZE blocks of DATA_FILE never change, so
+ * each is compressed once and shared by every compressed reader. Every reply
+ * walks the log from its start, so the cache keeps the first blocks up to
+ * frame_cache_limit bytes of frames; later blocks are compressed for each
+ * reply and freed after it. The partial last block is cached too, until the
+ * log grows past it. The whole cache is dropped when the last compressed
+ * client leaves.
+ */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct reply_frame **block_cache = NULL;
+static size_t block_cache_size = 0;
+static size_t block_cache_bytes = 0;
+static size_t frame_cache_limit = DEFAULT_FRAME_CACHE;
+static struct reply_frame *tail_frame = NULL;
+static size_t tail_block = 0;
+static atomic_int compressed_clients = 0;
+
+/*
+ * Freed buffers of exactly one huge page, kept for the next reply so the
+ * page is faulted in and zeroed once instead of once per reply. There is
+ * one list per NUMA node, filled and drained by threads running on that
+ * node, so a page first touched on one node is not handed to another.
+ */
+static pthread_mutex_t spare_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *spare_buffers[SPARE_NODES][SPARE_HUGE_BUFFERS];
+static int num_spare_buffers[SPARE_NODES];
+
 static void signal_handler(int signo) {
   if (signo == SIGINT || signo == SIGTERM) {
     caught_signal = 1;
@@ -60,69 +277,473 @@ static int setup_signal_handlers(void) {
   return 0;
 }
 
-static int append_to_file(const char *data, size_t len) {
-  // BLOQUEAMOS AL INICIO
-  pthread_mutex_lock(&file_mutex);
+static void shard_register(struct log_shard *shard) {
+  pthread_mutex_init(&shard->lock, NULL);
+  STAILQ_INIT(&shard->entries);
+  shard->dirty = 0;
+  shard->next_dirty = NULL;
+}
 
-  int fd = open(DATA_FILE, O_WRONLY | O_CREAT | O_APPEND, 0644);
-  if (fd == -1) {
-    syslog(LOG_ERR, "Failed to open %s: %s", DATA_FILE, strerror(errno));
-    pthread_mutex_unlock(&file_mutex); // IMPORTANTE: Desbloquear si hay error
+static int append_to_file(struct log_shard *shard, const char *data,
+                          size_t len) {
+  struct log_entry *entry = malloc(sizeof(*entry) + len);
+  if (entry == NULL) {
+    syslog(LOG_ERR, "Failed to allocate memory: %s", strerror(errno));
     return -1;
   }
+  entry->len = len;
+  memcpy(entry->data, data, len);
+
+  /*
+   * Take the sequence number under the shard lock, so a flush that finds a
+   * number taken but not queued yet only has to wait for this short section.
+   */
+  pthread_mutex_lock(&shard->lock);
+  entry->seq = atomic_fetch_add(&next_seq, 1);
+  STAILQ_INSERT_TAIL(&shard->entries, entry, entries);
+  if (!shard->dirty) {
+    /* next_dirty stays ours until a flush clears dirty again */
+    shard->dirty = 1;
+    struct log_shard *head = atomic_load(&dirty_shards);
+    do {
+      shard->next_dirty = head;
+    } while (!atomic_compare_exchange_weak(&dirty_shards, &head, shard));
+  }
+  pthread_mutex_unlock(&shard->lock);
 
-  ssize_t written = write(fd, data, len);
-  close(fd);
+  return 0;
+}
 
-  // DESBLOQUEAMOS AL FINAL
+static int compare_entries(const void *a, const void *b) {
+  const struct log_entry *x = *(const struct log_entry *const *)a;
+  const struct log_entry *y = *(const struct log_entry *const *)b;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/**
+ * Write the run of entries starting at committed_seq to fd in one batch and
+ * free them. Entries after a gap are put back on pending_entries, and so is
+ * every entry when the batch cannot be allocated.
+ */
+static int write_entries(int fd, struct log_entry **sorted, size_t count) {
+  size_t run = 0;
+  size_t run_len = 0;
+  int ret = 0;
+
+  while (run < count && sorted[run]->seq == committed_seq + run) {
+    run_len += sorted[run]->len;
+    run++;
+  }
+
+  char *batch = malloc(run_len > 0 ? run_len : 1);
+  if (batch == NULL) {
+    /* Keep every entry so a later flush can still write them */
+    syslog(LOG_ERR, "Failed to allocate memory: %s", strerror(errno));
+    for (size_t i = 0; i < count; i++)
+      STAILQ_INSERT_TAIL(&pending_entries, sorted[i], entries);
+    return -1;
+  }
+
+  size_t offset = 0;
+  for (size_t i = 0; i < run; i++) {
+    memcpy(batch + offset, sorted[i]->data, sorted[i]->len);
+    offset += sorted[i]->len;
+    free(sorted[i]);
+  }
+  committed_seq += run;
+
+  for (size_t i = run; i < count; i++)
+    STAILQ_INSERT_TAIL(&pending_entries, sorted[i], entries);
+
+  size_t written = 0;
+  while (written < run_len) {
+    ssize_t n = write(fd, batch + written, run_len - written);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      syslog(LOG_ERR, "Failed to write to %s: %s", DATA_FILE, strerror(errno));
+      ret = -1;
+      break;
+    }
+    written += n;
+  }
+  free(batch);
+
+  log_size += written;
+  log_packets += run;
+  return ret;
+}
+
+/**
+ * Merge every packet stamped so far from the dirty shards into DATA_FILE, in
+ * sequence order. Must be called with file_mutex held.
+ */
+static int flush_log(void) {
+  uint64_t target = atomic_load(&next_seq);
+  int ret = 0;
+
+  while (committed_seq < target) {
+    struct log_entry_list drained = STAILQ_HEAD_INITIALIZER(drained);
+    struct log_shard *shard;
+
+    STAILQ_CONCAT(&drained, &pending_entries);
+    shard = atomic_exchange(&dirty_shards, NULL);
+    while (shard != NULL) {
+      struct log_shard *next = shard->next_dirty;
+      pthread_mutex_lock(&shard->lock);
+      STAILQ_CONCAT(&drained, &shard->entries);
+      shard->dirty = 0;
+      pthread_mutex_unlock(&shard->lock);
+      shard = next;
+    }
+
+    size_t count = 0;
+    struct log_entry *entry;
+    STAILQ_FOREACH(entry, &drained, entries) { count++; }
+
+    if (count == 0) {
+      /* A writer took a number but has not queued its packet yet */
+      sched_yield();
+      continue;
+    }
+
+    struct log_entry **sorted = malloc(count * sizeof(*sorted));
+    if (sorted == NULL) {
+      syslog(LOG_ERR, "Failed to allocate memory: %s", strerror(errno));
+      STAILQ_CONCAT(&pending_entries, &drained);
+      ret = -1;
+      break;
+    }
+    count = 0;
+    STAILQ_FOREACH(entry, &drained, entries) { sorted[count++] = entry; }
+    qsort(sorted, count, sizeof(*sorted), compare_entries);
+
+    if (log_fd == -1) {
+      log_fd = open(DATA_FILE, O_RDWR | O_CREAT | O_APPEND, 0644);
+      if (log_fd == -1) {
+        syslog(LOG_ERR, "Failed to open %s: %s", DATA_FILE, strerror(errno));
+        for (size_t i = 0; i < count; i++)
+          STAILQ_INSERT_TAIL(&pending_entries, sorted[i], entries);
+        free(sorted);
+        ret = -1;
+        break;
+      }
+    }
+
+    uint64_t before = committed_seq;
+    int written = write_entries(log_fd, sorted, count);
+    free(sorted);
+    if (written == -1) {
+      ret = -1;
+      break;
+    }
+
+    if (committed_seq == before)
+      sched_yield();
+  }
+
+  return ret;
+}
+
+/**
+ * Flush whatever the shard still holds. flush_log() pops every dirty shard
+ * before it can fail, so afterwards the shard is off dirty_shards and can
+ * go away even if its packets are still pending.
+ */
+static void shard_unregister(struct log_shard *shard) {
+  pthread_mutex_lock(&file_mutex);
+  flush_log();
   pthread_mutex_unlock(&file_mutex);
 
-  if (written == -1 || (size_t)written != len) {
-    syslog(LOG_ERR, "Failed to write to %s: %s", DATA_FILE, strerror(errno));
+  pthread_mutex_destroy(&shard->lock);
+}
+
+/**
+ * Wait up to timeout_ms (forever if 0) for events on fd.
+ * Returns 1 when ready, 0 on timeout and -1 on error or shutdown.
+ */
+static int wait_for_socket(int fd, short events, int timeout_ms) {
+  struct pollfd pfd = {.fd = fd, .events = events};
+  int ret;
+
+  do {
+    ret = poll(&pfd, 1, timeout_ms > 0 ? timeout_ms : -1);
+  } while (ret == -1 && errno == EINTR && !caught_signal);
+
+  if (ret == -1)
     return -1;
+  return ret;
+}
+
+/**
+ * Send len bytes on the non-blocking client socket. A client which accepts
+ * nothing for send_timeout_ms is treated as dead. Pass MSG_MORE in flags for
+ * all but the last piece of a reply so its tail is not held back by Nagle.
+ */
+static int send_all(int client_fd, const char *data, size_t len, int flags) {
+  size_t total_sent = 0;
+  while (total_sent < len) {
+    ssize_t sent = send(client_fd, data + total_sent, len - total_sent,
+                        flags | MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        int ready =
+            wait_for_socket(client_fd, POLLOUT, conn_config.send_timeout_ms);
+        if (ready == 1)
+          continue;
+        if (ready == 0)
+          syslog(LOG_INFO, "Send timed out, dropping client");
+        return -1;
+      }
+      syslog(LOG_ERR, "Failed to send data to client: %s", strerror(errno));
+      return -1;
+    }
+    total_sent += sent;
   }
+  return 0;
+}
+
+static long elapsed_ms(const struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000 +
+         (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/**
+ * Hold back the next reply while more than max_queued bytes of earlier
+ * replies are unsent. A client that keeps reading, however slowly, only
+ * waits; one whose queue does not shrink at all for send_timeout_ms is
+ * dropped. SIOCOUTQNSD is TCP only, so Unix domain clients skip this and
+ * rely on the send timeout.
+ */
+static int check_backlog(int client_fd) {
+  int unsent = 0;
 
+  if (conn_config.max_queued == 0 ||
+      ioctl(client_fd, SIOCOUTQNSD, &unsent) == -1)
+    return 0;
+
+  struct timespec progress;
+  int lowest = unsent;
+  clock_gettime(CLOCK_MONOTONIC, &progress);
+  while ((size_t)unsent > conn_config.max_queued) {
+    if (caught_signal)
+      return -1;
+    if (conn_config.send_timeout_ms > 0 &&
+        elapsed_ms(&progress) >= conn_config.send_timeout_ms) {
+      syslog(LOG_INFO, "Client left %d unsent bytes for %d ms, dropping it",
+             unsent, conn_config.send_timeout_ms);
+      return -1;
+    }
+
+    struct timespec ts = {0, BACKLOG_POLL_MS * 1000000L};
+    nanosleep(&ts, NULL);
+    if (ioctl(client_fd, SIOCOUTQNSD, &unsent) == -1)
+      return 0;
+    if (unsent < lowest) {
+      lowest = unsent;
+      clock_gettime(CLOCK_MONOTONIC, &progress);
+    }
+  }
   return 0;
 }
 
-static int send_file_contents(int client_fd) {
+/**
+ * Return the shared log descriptor and the current size of DATA_FILE. The
+ * log is only ever appended to while running, so the first size bytes can
+ * be read with pread() without holding file_mutex. The descriptor must not
+ * be closed. Returns -1 on error and 0 with *fd == -1 if the log does not
+ * exist yet.
+ */
+static int open_log_snapshot(int *fd, off_t *size) {
+  struct stat st;
+
   // BLOQUEAMOS AL INICIO
   pthread_mutex_lock(&file_mutex);
 
-  int fd = open(DATA_FILE, O_RDONLY);
-  if (fd == -1) {
-    if (errno == ENOENT) {
-      pthread_mutex_unlock(&file_mutex); // IMPORTANTE
+  /* Merge the shards so the snapshot holds every packet stamped so far */
+  flush_log();
+
+  /* A log restored in persistent mode exists before the first flush */
+  if (log_fd == -1)
+    log_fd = open(DATA_FILE, O_RDWR | O_APPEND);
+  *fd = log_fd;
+  if (*fd == -1) {
+    pthread_mutex_unlock(&file_mutex); // IMPORTANTE
+    if (errno == ENOENT)
       return 0;
-    }
     syslog(LOG_ERR, "Failed to open %s for reading: %s", DATA_FILE,
            strerror(errno));
+    return -1;
+  }
+
+  if (fstat(*fd, &st) == -1) {
+    syslog(LOG_ERR, "Failed to stat %s: %s", DATA_FILE, strerror(errno));
+    *fd = -1;
     pthread_mutex_unlock(&file_mutex); // IMPORTANTE
     return -1;
   }
 
-  char buffer[BUFFER_SIZE];
-  ssize_t bytes_read;
+  // DESBLOQUEAMOS AL FINAL
+  pthread_mutex_unlock(&file_mutex);
 
-  while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
-    ssize_t total_sent = 0;
-    while (total_sent < bytes_read) {
-      ssize_t sent =
-          send(client_fd, buffer + total_sent, bytes_read - total_sent, 0);
-      if (sent == -1) {
-        syslog(LOG_ERR, "Failed to send data to client: %s", strerror(errno));
-        close(fd);
-        pthread_mutex_unlock(&file_mutex); // IMPORTANTE
-        return -1;
-      }
-      total_sent += sent;
+  *size = st.st_size;
+  return 0;
+}
+
+static size_t huge_round(size_t size) {
+  return (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+/**
+ * NUMA node of the CPU the calling thread runs on, or -1 when it has no
+ * spare list
+ */
+static int spare_node(void) {
+  unsigned int cpu, node;
+  if (getcpu(&cpu, &node) == -1 || node >= SPARE_NODES)
+    return -1;
+  return node;
+}
+
+/**
+ * Allocate a connection buffer. Large buffers are mapped directly, using
+ * MAP_HUGETLB when huge pages were requested and transparent huge pages
+ * otherwise. A THP can only back an aligned huge page, so that mapping is
+ * made one huge page larger and trimmed to an aligned start. New pages come
+ * from the node of the thread that first touches them. -W applies one CPU
+ * set to every worker, so they stay node-local only when that set lies
+ * within a single node.
+ */
+static char *buffer_alloc(size_t size) {
+  if (size < HUGE_BUFFER_THRESHOLD)
+    return malloc(size);
+
+  void *buffer = MAP_FAILED;
+  int node = size == HUGE_PAGE_SIZE ? spare_node() : -1;
+  if (node != -1) {
+    pthread_mutex_lock(&spare_mutex);
+    if (num_spare_buffers[node] > 0)
+      buffer = spare_buffers[node][--num_spare_buffers[node]];
+    pthread_mutex_unlock(&spare_mutex);
+    if (buffer != MAP_FAILED)
+      return buffer;
+  }
+
+  size_t len = huge_round(size);
+  if (huge_pages)
+    buffer = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (buffer == MAP_FAILED) {
+    char *map = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+      return NULL;
+    char *start = (char *)huge_round((uintptr_t)map);
+    if (start > map)
+      munmap(map, start - map);
+    munmap(start + len, map + HUGE_PAGE_SIZE - start);
+    madvise(start, len, MADV_HUGEPAGE);
+    buffer = start;
+  }
+  return buffer;
+}
+
+static void buffer_free(char *buffer, size_t size) {
+  if (buffer == NULL)
+    return;
+  if (size < HUGE_BUFFER_THRESHOLD) {
+    free(buffer);
+    return;
+  }
+
+  /* Buffers live for one reply, so the freeing thread is normally on the
+   * node that touched the pages */
+  int node = size == HUGE_PAGE_SIZE ? spare_node() : -1;
+  if (node != -1) {
+    pthread_mutex_lock(&spare_mutex);
+    if (num_spare_buffers[node] < SPARE_HUGE_BUFFERS) {
+      spare_buffers[node][num_spare_buffers[node]++] = buffer;
+      buffer = NULL;
     }
+    pthread_mutex_unlock(&spare_mutex);
+    if (buffer == NULL)
+      return;
   }
+  munmap(buffer, huge_round(size));
+}
 
-  close(fd);
+static void free_spare_buffers(void) {
+  pthread_mutex_lock(&spare_mutex);
+  for (int node = 0; node < SPARE_NODES; node++) {
+    while (num_spare_buffers[node] > 0)
+      munmap(spare_buffers[node][--num_spare_buffers[node]], HUGE_PAGE_SIZE);
+  }
+  pthread_mutex_unlock(&spare_mutex);
+}
 
-  // DESBLOQUEAMOS AL FINAL
-  pthread_mutex_unlock(&file_mutex);
+/**
+ * Grow a buffer from buffer_alloc() to new_size, keeping its first len bytes
+ */
+static char *buffer_grow(char *buffer, size_t size, size_t len,
+                         size_t new_size) {
+  if (new_size < HUGE_BUFFER_THRESHOLD)
+    return realloc(buffer, new_size);
+
+  char *new_buffer = buffer_alloc(new_size);
+  if (new_buffer == NULL)
+    return NULL;
+  memcpy(new_buffer, buffer, len);
+  buffer_free(buffer, size);
+  return new_buffer;
+}
+
+/**
+ * Send the log to the client. The read buffer is sized to the log and only
+ * held for this reply, so idle connections keep no memory; a huge page
+ * buffer comes back from the spare list without being faulted in again.
+ */
+static int send_file_contents(int client_fd) {
+  int fd;
+  off_t size = 0;
+
+  if (check_backlog(client_fd) == -1 || open_log_snapshot(&fd, &size) == -1)
+    return -1;
+  if (fd == -1)
+    return 0;
+
+  size_t buffer_size = BUFFER_SIZE;
+  if ((size_t)size >= REPLY_BUFFER_MAX / 2)
+    buffer_size = REPLY_BUFFER_MAX;
+  while (buffer_size < (size_t)size && buffer_size < REPLY_CHUNK_SIZE)
+    buffer_size *= 2;
+  char *buffer = buffer_alloc(buffer_size);
+  if (buffer == NULL) {
+    syslog(LOG_ERR, "Failed to allocate memory: %s", strerror(errno));
+    return -1;
+  }
+
+  ssize_t bytes_read = 0;
+  off_t offset = 0;
+
+  while (offset < size) {
+    size_t want = size - offset < (off_t)buffer_size ? (size_t)(size - offset)
+                                                     : buffer_size;
+    bytes_read = pread(fd, buffer, want, offset);
+    if (bytes_read <= 0)
+      break;
+    int more = offset + bytes_read < size ? MSG_MORE : 0;
+    if (send_all(client_fd, buffer, bytes_read, more) == -1) {
+      buffer_free(buffer, buffer_size);
+      return -1;
+    }
+    offset += bytes_read;
+  }
+
+  buffer_free(buffer, buffer_size);
 
   if (bytes_read == -1) {
     syslog(LOG_ERR, "Failed to read from %s: %s", DATA_FILE, strerror(errno));
@@ -132,25 +753,255 @@ static int send_file_contents(int client_fd) {
   return 0;
 }
 
+static void put_frame(struct reply_frame *frame) {
+  pthread_mutex_lock(&cache_mutex);
+  int refs = --frame->refs;
+  pthread_mutex_unlock(&cache_mutex);
+  if (refs == 0)
+    free(frame);
+}
+
+/**
+ * Read raw_len bytes at offset from fd and build a frame for them, falling
+ * back to storing the raw bytes if they do not compress.
+ */
+static struct reply_frame *build_frame(int fd, off_t offset, off_t raw_len) {
+  char *raw = malloc(raw_len);
+  struct reply_frame *frame =
+      malloc(sizeof(*frame) + FRAME_HEADER_SIZE + LZ4BLOCK_BOUND(raw_len));
+  if (raw == NULL || frame == NULL) {
+    syslog(LOG_ERR, "Failed to allocate memory: %s", strerror(errno));
+    free(raw);
+    free(frame);
+    return NULL;
+  }
+
+  ssize_t bytes_read = pread(fd, raw, raw_len, offset);
+  if (bytes_read != raw_len) {
+    syslog(LOG_ERR, "Failed to read from %s: %s", DATA_FILE, strerror(errno));
+    free(raw);
+    free(frame);
+    return NULL;
+  }
+
+  char *payload = frame->data + FRAME_HEADER_SIZE;
+  size_t payload_len = lz4block_compress(raw, raw_len, payload);
+  if (payload_len >= (size_t)raw_len) {
+    memcpy(payload, raw, raw_len);
+    payload_len = raw_len;
+  }
+  free(raw);
+
+  uint32_t header[2] = {htonl(raw_len), htonl(payload_len)};
+  memcpy(frame->data, header, sizeof(header));
+  frame->refs = 1;
+  frame->raw_len = raw_len;
+  frame->len = FRAME_HEADER_SIZE + payload_len;
+  return frame;
+}
+
+/**
+ * Return the frame for block number block of a log of log_len bytes, from
+ * the cache when possible. The caller drops its reference with put_frame().
+ */
+static struct reply_frame *get_frame(int fd, size_t block, off_t log_len) {
+  off_t offset = (off_t)block * COMPRESS_BLOCK_SIZE;
+  off_t raw_len = log_len - offset;
+  int full = raw_len >= COMPRESS_BLOCK_SIZE;
+  struct reply_frame *frame = NULL;
+
+  if (full)
+    raw_len = COMPRESS_BLOCK_SIZE;
+
+  pthread_mutex_lock(&cache_mutex);
+  if (full && block < block_cache_size)
+    frame = block_cache[block];
+  else if (!full && tail_frame != NULL && tail_frame->raw_len == raw_len &&
+           block == tail_block)
+    frame = tail_frame;
+  if (frame != NULL)
+    frame->refs++;
+  pthread_mutex_unlock(&cache_mutex);
+
+  if (frame != NULL)
+    return frame;
+
+  frame = build_frame(fd, offset, raw_len);
+  if (frame == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&cache_mutex);
+  if (full && block == block_cache_size &&
+      block_cache_bytes + frame->len <= frame_cache_limit) {
+    struct reply_frame **new_cache =
+        realloc(block_cache, (block_cache_size + 1) * sizeof(*block_cache));
+    if (new_cache != NULL) {
+      block_cache = new_cache;
+      block_cache[block_cache_size++] = frame;
+      block_cache_bytes += frame->len;
+      frame->refs++;
+    }
+  } else if (!full) {
+    struct reply_frame *old_tail = tail_frame;
+    tail_frame = frame;
+    tail_block = block;
+    frame->refs++;
+    if (old_tail != NULL && --old_tail->refs == 0)
+      free(old_tail);
+  }
+  pthread_mutex_unlock(&cache_mutex);
+
+  return frame;
+}
+
+/**
+ * Compressed counterpart of send_file_contents(): send the log as a sequence
+ * of frames followed by the end of reply marker.
+ */
+static int send_compressed_contents(int client_fd) {
+  static const char end_marker[FRAME_HEADER_SIZE] = {0};
+  int fd;
+  off_t size = 0;
+  int ret = 0;
+
+  if (check_backlog(client_fd) == -1 || open_log_snapshot(&fd, &size) == -1)
+    return -1;
+  if (fd == -1)
+    return send_all(client_fd, end_marker, sizeof(end_marker), 0);
+
+  size_t blocks = (size + COMPRESS_BLOCK_SIZE - 1) / COMPRESS_BLOCK_SIZE;
+  for (size_t block = 0; block < blocks && ret == 0; block++) {
+    struct reply_frame *frame = get_frame(fd, block, size);
+    if (frame == NULL) {
+      ret = -1;
+      break;
+    }
+    ret = send_all(client_fd, frame->data, frame->len, MSG_MORE);
+    put_frame(frame);
+  }
+
+  if (ret == 0)
+    ret = send_all(client_fd, end_marker, sizeof(end_marker), 0);
+  return ret;
+}
+
+/**
+ * Drop the cache's references to its frames. Frames still being sent are
+ * freed by the last put_frame().
+ */
+static void free_frame_cache(void) {
+  pthread_mutex_lock(&cache_mutex);
+  for (size_t i = 0; i < block_cache_size; i++) {
+    if (--block_cache[i]->refs == 0)
+      free(block_cache[i]);
+  }
+  free(block_cache);
+  block_cache = NULL;
+  block_cache_size = 0;
+  block_cache_bytes = 0;
+  if (tail_frame != NULL && --tail_frame->refs == 0)
+    free(tail_frame);
+  tail_frame = NULL;
+  pthread_mutex_unlock(&cache_mutex);
+}
+
+/**
+ * Make the client socket non-blocking and apply keepalive and send buffer
+ * settings from conn_config.
+ */
+static void setup_client_socket(int client_fd) {
+  int flags = fcntl(client_fd, F_GETFL);
+  if (flags == -1 || fcntl(client_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    syslog(LOG_ERR, "Failed to make client socket non-blocking: %s",
+           strerror(errno));
+
+  /* The rest is TCP tuning, local clients do not need it */
+  int domain = AF_UNSPEC;
+  socklen_t domain_len = sizeof(domain);
+  if (getsockopt(client_fd, SOL_SOCKET, SO_DOMAIN, &domain, &domain_len) ==
+          -1 ||
+      domain == AF_UNIX)
+    return;
+
+  if (conn_config.keepalive_idle_s > 0) {
+    int on = 1;
+    int idle = conn_config.keepalive_idle_s;
+    int interval = KEEPALIVE_INTERVAL_S;
+    int count = KEEPALIVE_COUNT;
+    if (setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) ==
+            -1 ||
+        setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) ==
+            -1 ||
+        setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval,
+                   sizeof(interval)) == -1 ||
+        setsockopt(client_fd, IPPROTO_TCP, TCP_KEEPCNT, &count,
+                   sizeof(count)) == -1)
+      syslog(LOG_ERR, "Failed to enable keepalive: %s", strerror(errno));
+  }
+
+  if (conn_config.sndbuf > 0 &&
+      setsockopt(client_fd, SOL_SOCKET, SO_SNDBUF, &conn_config.sndbuf,
+                 sizeof(conn_config.sndbuf)) == -1)
+    syslog(LOG_ERR, "Failed to set SO_SNDBUF: %s", strerror(errno));
+
+  if (conn_config.notsent_lowat > 0 &&
+      setsockopt(client_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                 &conn_config.notsent_lowat,
+                 sizeof(conn_config.notsent_lowat)) == -1)
+    syslog(LOG_ERR, "Failed to set TCP_NOTSENT_LOWAT: %s", strerror(errno));
+}
+
 static void handle_client(int client_fd, const char *client_ip) {
   char *recv_buffer = NULL;
   size_t recv_buffer_size = 0;
   size_t recv_buffer_len = 0;
   char temp_buffer[BUFFER_SIZE];
+  int compress = 0;
+  /* Start of the idle period, or of the pending partial packet */
+  struct timespec wait_start;
+  struct log_shard shard;
+
+  shard_register(&shard);
+  setup_client_socket(client_fd);
+  clock_gettime(CLOCK_MONOTONIC, &wait_start);
 
   while (!caught_signal) {
+    int timeout_ms = recv_buffer_len > 0 ? conn_config.read_timeout_ms
+                                         : conn_config.idle_timeout_ms;
+    if (timeout_ms > 0) {
+      timeout_ms -= elapsed_ms(&wait_start);
+      if (timeout_ms <= 0) {
+        syslog(LOG_INFO, "Closing %s connection from %s",
+               recv_buffer_len > 0 ? "stalled" : "idle", client_ip);
+        break;
+      }
+    }
+
+    int ready = wait_for_socket(client_fd, POLLIN, timeout_ms);
+    if (ready == 0)
+      continue; /* Timeout is reported at the top of the loop */
+    if (ready == -1)
+      break;
+
     ssize_t bytes_received =
         recv(client_fd, temp_buffer, sizeof(temp_buffer), 0);
 
     if (bytes_received <= 0) {
       if (bytes_received == 0)
         break;
-      if (errno == EINTR)
+      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
         continue;
       syslog(LOG_ERR, "recv error: %s", strerror(errno));
       break;
     }
 
+    if (recv_buffer_len + bytes_received > conn_config.max_packet &&
+        conn_config.max_packet > 0) {
+      syslog(LOG_INFO, "Packet from %s exceeds %zu bytes, dropping client",
+             client_ip, conn_config.max_packet);
+      break;
+    }
+
     /* Grow buffer if needed */
     size_t new_len = recv_buffer_len + bytes_received;
     if (new_len > recv_buffer_size) {
@@ -159,7 +1010,8 @@ static void handle_client(int client_fd, const char *client_ip) {
       while (new_size < new_len) {
         new_size *= 2;
       }
-      char *new_buffer = realloc(recv_buffer, new_size);
+      char *new_buffer =
+          buffer_grow(recv_buffer, recv_buffer_size, recv_buffer_len, new_size);
       if (new_buffer == NULL) {
         syslog(LOG_ERR, "Failed to allocate memory: %s", strerror(errno));
         break;
@@ -169,10 +1021,12 @@ static void handle_client(int client_fd, const char *client_ip) {
     }
 
     /* Append received data to buffer */
+    size_t prev_len = recv_buffer_len;
     memcpy(recv_buffer + recv_buffer_len, temp_buffer, bytes_received);
     recv_buffer_len = new_len;
 
     /* Check for complete packets (newline-terminated) */
+    int send_failed = 0;
     char *newline;
     char *search_start = recv_buffer;
     size_t remaining = recv_buffer_len;
@@ -180,14 +1034,22 @@ static void handle_client(int client_fd, const char *client_ip) {
     while ((newline = memchr(search_start, '\n', remaining)) != NULL) {
       size_t packet_len = newline - search_start + 1; /* Include the newline */
 
-      /* Append packet to file */
-      if (append_to_file(search_start, packet_len) == -1) {
+      if (packet_len == strlen(COMPRESS_CMD) &&
+          memcmp(search_start, COMPRESS_CMD, packet_len) == 0) {
+        /* Negotiation packet, not part of the log */
+        if (!compress)
+          atomic_fetch_add(&compressed_clients, 1);
+        compress = 1;
+      } else if (append_to_file(&shard, search_start, packet_len) == -1) {
         syslog(LOG_ERR, "Failed to append data to file");
       }
 
       /* Send file contents to client */
-      if (send_file_contents(client_fd) == -1) {
+      if ((compress ? send_compressed_contents(client_fd)
+                    : send_file_contents(client_fd)) == -1) {
         syslog(LOG_ERR, "Failed to send file contents to client");
+        send_failed = 1;
+        break;
       }
 
       search_start = newline + 1;
@@ -198,10 +1060,23 @@ static void handle_client(int client_fd, const char *client_ip) {
     if (search_start > recv_buffer && remaining > 0) {
       memmove(recv_buffer, search_start, remaining);
     }
+    if (send_failed)
+      break;
+
+    /* Timeouts restart after a packet or when a partial one begins */
+    if (prev_len == 0 || search_start > recv_buffer)
+      clock_gettime(CLOCK_MONOTONIC, &wait_start);
     recv_buffer_len = remaining;
   }
 
-  free(recv_buffer);
+  buffer_free(recv_buffer, recv_buffer_size);
+  shard_unregister(&shard);
+
+  /* Nobody reads the frames any more, give their memory back */
+  if (compress && atomic_fetch_sub(&compressed_clients, 1) == 1) {
+    free_frame_cache();
+    malloc_trim(0);
+  }
   // syslog(LOG_INFO, "Closed connection from %s", client_ip); // Moved
   // close/log logic to main or thread cleanup
 }
@@ -214,11 +1089,14 @@ static void *thread_func(void *thread_param) {
   syslog(LOG_INFO, "Closed connection from %s", data->client_ip);
   close(data->client_fd);
 
-  data->thread_complete_flag = 1;
+  atomic_store(&data->thread_complete_flag, 1);
   return NULL;
 }
 
 static void *timestamp_func(void *param) {
+  struct log_shard shard;
+
+  shard_register(&shard);
   while (!caught_signal) {
     // Sleep for 10 seconds in small intervals so we exit quickly on signal
     int i;
@@ -242,26 +1120,388 @@ static void *timestamp_func(void *param) {
              tm_info);
     snprintf(out_buffer, sizeof(out_buffer), "timestamp:%s\n", time_buffer);
 
-    if (append_to_file(out_buffer, strlen(out_buffer)) == -1) {
+    if (append_to_file(&shard, out_buffer, strlen(out_buffer)) == -1) {
       syslog(LOG_ERR, "Failed to write timestamp to file");
     }
+
+    /* Write it out now, the log may have no reader for a long time */
+    pthread_mutex_lock(&file_mutex);
+    flush_log();
+    pthread_mutex_unlock(&file_mutex);
   }
+  shard_unregister(&shard);
   return NULL;
 }
 
+/**
+ * Add an endpoint from a -l argument: tcp:PORT, tcp6:PORT or unix:PATH
+ */
+static int add_listener(const char *spec) {
+  struct listener *l = &listeners[num_listeners];
+  const char *arg = strchr(spec, ':');
+
+  if (num_listeners == MAX_LISTENERS || arg == NULL || arg[1] == '\0')
+    return -1;
+  arg++;
+
+  memset(l, 0, sizeof(*l));
+  l->fd = -1;
+  if (strncmp(spec, "unix:", 5) == 0) {
+    /* Daemon mode changes to / later, so keep the path usable from there */
+    char cwd[PATH_MAX];
+    if (arg[0] == '/') {
+      cwd[0] = '\0';
+    } else if (getcwd(cwd, sizeof(cwd) - 1) == NULL) {
+      return -1;
+    } else if (strcmp(cwd, "/") != 0) {
+      strcat(cwd, "/");
+    }
+    if (strlen(cwd) + strlen(arg) >= sizeof(l->path))
+      return -1;
+    l->family = AF_UNIX;
+    strcpy(l->path, cwd);
+    strcat(l->path, arg);
+  } else {
+    char *end;
+    long port = strtol(arg, &end, 10);
+    if (*end != '\0' || port <= 0 || port > 65535)
+      return -1;
+    if (strncmp(spec, "tcp:", 4) == 0)
+      l->family = AF_INET;
+    else if (strncmp(spec, "tcp6:", 5) == 0)
+      l->family = AF_INET6;
+    else
+      return -1;
+    l->port = port;
+  }
+
+  num_listeners++;
+  return 0;
+}
+
+static const char *listener_name(const struct listener *l, char *buf,
+                                 size_t len) {
+  if (l->family == AF_UNIX)
+    snprintf(buf, len, "unix:%s", l->path);
+  else
+    snprintf(buf, len, "%s:%d", l->family == AF_INET6 ? "tcp6" : "tcp",
+             l->port);
+  return buf;
+}
+
+/**
+ * An IPv6 listener is dual stack unless an IPv4 listener claims its port
+ */
+static int ipv4_listener_on(int port) {
+  for (int i = 0; i < num_listeners; i++) {
+    if (listeners[i].family == AF_INET && listeners[i].port == port)
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Create and bind the socket for l
+ */
+static int open_listener(struct listener *l) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  char name[PEER_NAME_SIZE];
+
+  listener_name(l, name, sizeof(name));
+  memset(&addr, 0, sizeof(addr));
+
+  /* Create socket */
+  l->fd = socket(l->family, SOCK_STREAM, 0);
+  if (l->fd == -1) {
+    syslog(LOG_ERR, "Failed to create socket for %s: %s", name,
+           strerror(errno));
+    return -1;
+  }
+
+  if (l->family == AF_UNIX) {
+    struct sockaddr_un *sun = (struct sockaddr_un *)&addr;
+    struct stat st;
+
+    sun->sun_family = AF_UNIX;
+    strcpy(sun->sun_path, l->path);
+    addr_len = sizeof(*sun);
+
+    /* Remove the socket left by a previous instance, but only once a
+     * connect shows nobody is listening on it any more */
+    if (lstat(l->path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+      int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (probe == -1) {
+        syslog(LOG_ERR, "Failed to create socket for %s: %s", name,
+               strerror(errno));
+        return -1;
+      }
+      int live = connect(probe, (struct sockaddr *)&addr, addr_len) == 0;
+      int probe_errno = errno;
+      close(probe);
+      if (live) {
+        syslog(LOG_ERR, "%s is in use by another server", name);
+        return -1;
+      }
+      if (probe_errno != ECONNREFUSED) {
+        syslog(LOG_ERR, "Failed to probe %s: %s", name,
+               strerror(probe_errno));
+        return -1;
+      }
+      unlink(l->path);
+    }
+  } else {
+    /* Set socket options */
+    int reuse = 1;
+    if (setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) ==
+        -1) {
+      syslog(LOG_ERR, "Failed to set socket options: %s", strerror(errno));
+      return -1;
+    }
+
+    if (l->family == AF_INET6) {
+      struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+      int v6only = ipv4_listener_on(l->port);
+      if (setsockopt(l->fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only,
+                     sizeof(v6only)) == -1) {
+        syslog(LOG_ERR, "Failed to set IPV6_V6ONLY: %s", strerror(errno));
+        return -1;
+      }
+      sin6->sin6_family = AF_INET6;
+      sin6->sin6_addr = in6addr_any;
+      sin6->sin6_port = htons(l->port);
+      addr_len = sizeof(*sin6);
+    } else {
+      struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+      sin->sin_family = AF_INET;
+      sin->sin_addr.s_addr = INADDR_ANY;
+      sin->sin_port = htons(l->port);
+      addr_len = sizeof(*sin);
+    }
+  }
+
+  /* Retry bind in case a previous instance hasn't fully released the port.
+   * A Unix path in use was just checked to be live, so waiting won't help. */
+  int bind_retries = l->family == AF_UNIX ? 1 : 10;
+  while (bind(l->fd, (struct sockaddr *)&addr, addr_len) == -1) {
+    if (errno == EADDRINUSE && --bind_retries > 0) {
+      syslog(LOG_INFO, "%s in use, retrying bind (%d attempts left)...", name,
+             bind_retries);
+      sleep(1);
+      continue;
+    }
+    syslog(LOG_ERR, "Failed to bind %s: %s", name, strerror(errno));
+    return -1;
+  }
+  l->bound = 1;
+
+  return 0;
+}
+
+static void close_listeners(void) {
+  for (int i = 0; i < num_listeners; i++) {
+    if (listeners[i].fd == -1)
+      continue;
+    close(listeners[i].fd);
+    listeners[i].fd = -1;
+    if (listeners[i].family == AF_UNIX && listeners[i].bound)
+      unlink(listeners[i].path);
+    listeners[i].bound = 0;
+  }
+}
+
+/**
+ * Format the address of an accepted peer for logging
+ */
+static void format_peer(const struct sockaddr_storage *addr, char *buf,
+                        size_t len) {
+  switch (addr->ss_family) {
+  case AF_INET:
+    inet_ntop(AF_INET, &((const struct sockaddr_in *)addr)->sin_addr, buf, len);
+    break;
+  case AF_INET6:
+    inet_ntop(AF_INET6, &((const struct sockaddr_in6 *)addr)->sin6_addr, buf,
+              len);
+    break;
+  case AF_UNIX:
+    snprintf(buf, len, "local client");
+    break;
+  default:
+    snprintf(buf, len, "unknown peer");
+    break;
+  }
+}
+
+/**
+ * Load the checkpoint written by save_log_index(). Returns 0 and fills index
+ * only if it matches the current DATA_FILE.
+ */
+static int load_log_index(const struct stat *st, struct log_index *index) {
+  int fd = open(INDEX_FILE, O_RDONLY);
+  if (fd == -1)
+    return -1;
+
+  ssize_t bytes_read = read(fd, index, sizeof(*index));
+  close(fd);
+
+  if (bytes_read != (ssize_t)sizeof(*index) || index->magic != INDEX_MAGIC ||
+      index->version != INDEX_VERSION || index->inode != (uint64_t)st->st_ino ||
+      index->size > (uint64_t)st->st_size) {
+    syslog(LOG_INFO, "Ignoring stale or invalid %s", INDEX_FILE);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Reload DATA_FILE left by a previous run in persistent mode. The checkpoint
+ * covers everything up to index.size, so only the tail after it is mapped
+ * and scanned. A trailing partial packet (torn write on crash) is truncated.
+ */
+static int restore_log(void) {
+  struct stat st;
+  struct log_index index = {0};
+
+  int fd = open(DATA_FILE, O_RDWR);
+  if (fd == -1) {
+    if (errno == ENOENT)
+      return 0;
+    syslog(LOG_ERR, "Failed to open %s: %s", DATA_FILE, strerror(errno));
+    return -1;
+  }
+
+  if (fstat(fd, &st) == -1) {
+    syslog(LOG_ERR, "Failed to stat %s: %s", DATA_FILE, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  if (load_log_index(&st, &index) == -1) {
+    index.size = 0;
+    index.packets = 0;
+  }
+
+  off_t valid_size = index.size;
+  uint64_t packets = index.packets;
+
+  if ((off_t)index.size < st.st_size) {
+    /* mmap offsets must be page aligned */
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t map_start = index.size - (index.size % page);
+    size_t map_len = st.st_size - map_start;
+
+    char *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_start);
+    if (map == MAP_FAILED) {
+      syslog(LOG_ERR, "Failed to map %s: %s", DATA_FILE, strerror(errno));
+      close(fd);
+      return -1;
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+
+    const char *tail = map + (index.size - map_start);
+    const char *end = map + map_len;
+    const char *newline;
+    while ((newline = memchr(tail, '\n', end - tail)) != NULL) {
+      packets++;
+      tail = newline + 1;
+    }
+    valid_size = map_start + (tail - map);
+
+    munmap(map, map_len);
+  }
+
+  if (valid_size < st.st_size) {
+    syslog(LOG_INFO, "Truncating %ld bytes of partial packet from %s",
+           (long)(st.st_size - valid_size), DATA_FILE);
+    if (ftruncate(fd, valid_size) == -1) {
+      syslog(LOG_ERR, "Failed to truncate %s: %s", DATA_FILE, strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+  close(fd);
+
+  pthread_mutex_lock(&file_mutex);
+  log_size = valid_size;
+  log_packets = packets;
+  pthread_mutex_unlock(&file_mutex);
+
+  syslog(LOG_INFO, "Restored %llu packets (%ld bytes) from %s",
+         (unsigned long long)packets, (long)valid_size, DATA_FILE);
+  return 0;
+}
+
+/**
+ * Flush DATA_FILE and write its checkpoint so the next start can skip
+ * rescanning it. The index is written to a temporary file and renamed so a
+ * crash never leaves a half written checkpoint behind.
+ */
+static int save_log_index(void) {
+  struct stat st;
+  struct log_index index = {0};
+
+  pthread_mutex_lock(&file_mutex);
+  flush_log();
+
+  int fd = open(DATA_FILE, O_RDONLY);
+  if (fd == -1) {
+    pthread_mutex_unlock(&file_mutex);
+    if (errno == ENOENT) {
+      unlink(INDEX_FILE);
+      return 0;
+    }
+    syslog(LOG_ERR, "Failed to open %s: %s", DATA_FILE, strerror(errno));
+    return -1;
+  }
+  fsync(fd);
+  int s = fstat(fd, &st);
+  close(fd);
+
+  index.magic = INDEX_MAGIC;
+  index.version = INDEX_VERSION;
+  index.inode = st.st_ino;
+  index.size = log_size;
+  index.packets = log_packets;
+
+  pthread_mutex_unlock(&file_mutex);
+
+  if (s == -1 || st.st_size != log_size) {
+    /* Written to by someone else, let the next start rescan it */
+    unlink(INDEX_FILE);
+    return 0;
+  }
+
+  fd = open(INDEX_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    syslog(LOG_ERR, "Failed to open %s.tmp: %s", INDEX_FILE, strerror(errno));
+    return -1;
+  }
+  ssize_t written = write(fd, &index, sizeof(index));
+  if (written != (ssize_t)sizeof(index) || fsync(fd) == -1) {
+    syslog(LOG_ERR, "Failed to write %s.tmp: %s", INDEX_FILE, strerror(errno));
+    close(fd);
+    unlink(INDEX_FILE ".tmp");
+    return -1;
+  }
+  close(fd);
+
+  if (rename(INDEX_FILE ".tmp", INDEX_FILE) == -1) {
+    syslog(LOG_ERR, "Failed to rename %s.tmp: %s", INDEX_FILE, strerror(errno));
+    unlink(INDEX_FILE ".tmp");
+    return -1;
+  }
+
+  return 0;
+}
+
 /**
  * Cleanup resources and exit
  */
 static void cleanup_and_exit(void) {
   syslog(LOG_INFO, "Caught signal, exiting");
 
-  if (server_fd != -1) {
-    close(server_fd);
-    server_fd = -1;
-  }
-
-  /* Delete the data file */
-  unlink(DATA_FILE);
+  close_listeners();
 
   // Request exit from each thread
   struct thread_data *datap = NULL;
@@ -279,28 +1519,197 @@ static void cleanup_and_exit(void) {
     free(datap);
   }
 
+  /* Keep the data file for the next run in persistent mode */
+  if (persist_mode) {
+    save_log_index();
+  } else {
+    unlink(DATA_FILE);
+    unlink(INDEX_FILE);
+  }
+
+  if (log_fd != -1)
+    close(log_fd);
+  free_frame_cache();
+  free_spare_buffers();
   pthread_mutex_destroy(&file_mutex);
 
   closelog();
 }
 
+/**
+ * Parse a CPU list such as "0-3,8" into set
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *set) {
+  const char *p = list;
+
+  CPU_ZERO(set);
+  while (*p != '\0') {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p || first < 0)
+      return -1;
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first)
+        return -1;
+    }
+    if (last >= CPU_SETSIZE)
+      return -1;
+    for (long cpu = first; cpu <= last; cpu++)
+      CPU_SET(cpu, set);
+    if (*end == ',')
+      end++;
+    else if (*end != '\0')
+      return -1;
+    p = end;
+  }
+  return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+/**
+ * Prepare attr so a new thread starts on the CPUs configured for its role,
+ * before it allocates any memory. Returns NULL when nothing is pinned.
+ */
+static pthread_attr_t *placement_attr(pthread_attr_t *attr,
+                                      const cpu_set_t *set, int set_configured) {
+  if (!cpu_placement.accept_set && !set_configured)
+    return NULL;
+
+  /* The accept thread may be pinned, do not let the new thread inherit it */
+  if (!set_configured)
+    set = &cpu_placement.startup;
+
+  if (pthread_attr_init(attr) != 0)
+    return NULL;
+  if (pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), set) != 0) {
+    syslog(LOG_ERR, "Failed to set thread affinity");
+    pthread_attr_destroy(attr);
+    return NULL;
+  }
+  return attr;
+}
+
+/**
+ * Join and free the threads of connections which have been closed
+ */
+static void reap_completed_threads(void) {
+  struct thread_data *datap = NULL;
+  struct thread_data *tmp = NULL;
+  datap = SLIST_FIRST(&head);
+  while (datap != NULL) {
+    tmp = SLIST_NEXT(datap, entries);
+    if (atomic_load(&datap->thread_complete_flag)) {
+      pthread_join(datap->thread_id, NULL);
+      SLIST_REMOVE(&head, datap, thread_data, entries);
+      free(datap);
+    }
+    datap = tmp;
+  }
+}
+
+/**
+ * Parse a non-negative integer option argument.
+ */
+static int parse_count(const char *arg, long max, long *value) {
+  char *end;
+  errno = 0;
+  *value = strtol(arg, &end, 10);
+  if (errno != 0 || end == arg || *end != '\0' || *value < 0 || *value > max)
+    return -1;
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [-d] [-p] [-t idle_s] [-r read_s] [-s send_s] "
+          "[-k keepalive_s] [-b sndbuf] [-q max_queued] [-c cache_bytes] "
+          "[-A cpus] [-W cpus] [-T cpus] [-H] "
+          "[-l tcp:PORT|tcp6:PORT|unix:PATH]...\n",
+          prog);
+}
+
 int main(int argc, char *argv[]) {
   int ret = 0;
   int daemon_mode = 0;
   int opt;
-  struct sockaddr_in server_addr, client_addr;
-  socklen_t client_addr_len = sizeof(client_addr);
+  struct sockaddr_storage client_addr;
+  socklen_t client_addr_len;
   pthread_t timestamp_thread;
   int timestamp_thread_started = 0;
 
   /* Parse command line arguments */
-  while ((opt = getopt(argc, argv, "d")) != -1) {
+  long value;
+  sched_getaffinity(0, sizeof(cpu_placement.startup), &cpu_placement.startup);
+  while ((opt = getopt(argc, argv, "dpt:r:s:k:b:q:c:A:W:T:Hl:")) != -1) {
     switch (opt) {
     case 'd':
       daemon_mode = 1;
       break;
+    case 'p':
+      persist_mode = 1;
+      break;
+    case 't':
+    case 'r':
+    case 's':
+    case 'k':
+      if (parse_count(optarg, 86400, &value) == -1) {
+        usage(argv[0]);
+        return -1;
+      }
+      if (opt == 't')
+        conn_config.idle_timeout_ms = value * 1000;
+      else if (opt == 'r')
+        conn_config.read_timeout_ms = value * 1000;
+      else if (opt == 's')
+        conn_config.send_timeout_ms = value * 1000;
+      else
+        conn_config.keepalive_idle_s = value;
+      break;
+    case 'b':
+    case 'q':
+    case 'c':
+      if (parse_count(optarg, INT32_MAX, &value) == -1) {
+        usage(argv[0]);
+        return -1;
+      }
+      if (opt == 'b')
+        conn_config.sndbuf = value;
+      else if (opt == 'q')
+        conn_config.max_queued = value;
+      else
+        frame_cache_limit = value;
+      break;
+    case 'A':
+    case 'W':
+    case 'T': {
+      cpu_set_t *set = opt == 'A'   ? &cpu_placement.accept
+                       : opt == 'W' ? &cpu_placement.workers
+                                    : &cpu_placement.timestamp;
+      if (parse_cpu_list(optarg, set) == -1) {
+        fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+        return -1;
+      }
+      if (opt == 'A')
+        cpu_placement.accept_set = 1;
+      else if (opt == 'W')
+        cpu_placement.workers_set = 1;
+      else
+        cpu_placement.timestamp_set = 1;
+      break;
+    }
+    case 'H':
+      huge_pages = 1;
+      break;
+    case 'l':
+      if (add_listener(optarg) == -1) {
+        fprintf(stderr, "Invalid or too many listeners: %s\n", optarg);
+        return -1;
+      }
+      break;
     default:
-      fprintf(stderr, "Usage: %s [-d]\n", argv[0]);
+      usage(argv[0]);
       return -1;
     }
   }
@@ -314,44 +1723,23 @@ int main(int argc, char *argv[]) {
     return -1;
   }
 
-  /* Create socket */
-  server_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (server_fd == -1) {
-    syslog(LOG_ERR, "Failed to create socket: %s", strerror(errno));
+  /* Reload the log left by a previous persistent run */
+  if (persist_mode && restore_log() == -1) {
     closelog();
     return -1;
   }
 
-  /* Set socket options */
-  int reuse = 1;
-  if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) ==
-      -1) {
-    syslog(LOG_ERR, "Failed to set socket options: %s", strerror(errno));
-    close(server_fd);
-    closelog();
-    return -1;
+  if (num_listeners == 0) {
+    add_listener(DEFAULT_LISTENER);
   }
 
-  /* Bind to port */
-  memset(&server_addr, 0, sizeof(server_addr));
-  server_addr.sin_family = AF_INET;
-  server_addr.sin_addr.s_addr = INADDR_ANY;
-  server_addr.sin_port = htons(PORT);
-
-  /* Retry bind in case a previous instance hasn't fully released the port */
-  int bind_retries = 10;
-  while (bind(server_fd, (struct sockaddr *)&server_addr,
-              sizeof(server_addr)) == -1) {
-    if (errno == EADDRINUSE && --bind_retries > 0) {
-      syslog(LOG_INFO, "Port %d in use, retrying bind (%d attempts left)...",
-             PORT, bind_retries);
-      sleep(1);
-      continue;
+  /* Create and bind every listener before forking */
+  for (int i = 0; i < num_listeners; i++) {
+    if (open_listener(&listeners[i]) == -1) {
+      close_listeners();
+      closelog();
+      return -1;
     }
-    syslog(LOG_ERR, "Failed to bind socket: %s", strerror(errno));
-    close(server_fd);
-    closelog();
-    return -1;
   }
 
   /* Fork to daemon mode after successful bind */
@@ -359,7 +1747,7 @@ int main(int argc, char *argv[]) {
     pid_t pid = fork();
     if (pid == -1) {
       syslog(LOG_ERR, "Failed to fork: %s", strerror(errno));
-      close(server_fd);
+      close_listeners();
       closelog();
       return -1;
     }
@@ -372,7 +1760,7 @@ int main(int argc, char *argv[]) {
     /* Create new session */
     if (setsid() == -1) {
       syslog(LOG_ERR, "Failed to create new session: %s", strerror(errno));
-      close(server_fd);
+      close_listeners();
       closelog();
       return -1;
     }
@@ -395,28 +1783,70 @@ int main(int argc, char *argv[]) {
   }
 
   /* Listen for connections */
-  if (listen(server_fd, 10) == -1) {
-    syslog(LOG_ERR, "Failed to listen on socket: %s", strerror(errno));
-    close(server_fd);
-    closelog();
-    return -1;
+  struct pollfd listen_fds[MAX_LISTENERS];
+  for (int i = 0; i < num_listeners; i++) {
+    char name[PEER_NAME_SIZE];
+    listener_name(&listeners[i], name, sizeof(name));
+    if (listen(listeners[i].fd, SOMAXCONN) == -1) {
+      syslog(LOG_ERR, "Failed to listen on %s: %s", name, strerror(errno));
+      close_listeners();
+      closelog();
+      return -1;
+    }
+    listen_fds[i].fd = listeners[i].fd;
+    listen_fds[i].events = POLLIN;
+    syslog(LOG_INFO, "Server listening on %s", name);
   }
 
-  syslog(LOG_INFO, "Server listening on port %d", PORT);
-
   SLIST_INIT(&head);
 
+  // Pin the accept loop (this thread)
+  if (cpu_placement.accept_set &&
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                             &cpu_placement.accept) != 0) {
+    syslog(LOG_ERR, "Failed to set accept thread affinity");
+  }
+
   // Start timestamp thread
-  if (pthread_create(&timestamp_thread, NULL, timestamp_func, NULL) != 0) {
+  pthread_attr_t attr;
+  pthread_attr_t *attrp = placement_attr(&attr, &cpu_placement.timestamp,
+                                         cpu_placement.timestamp_set);
+  int s = pthread_create(&timestamp_thread, attrp, timestamp_func, NULL);
+  if (attrp != NULL)
+    pthread_attr_destroy(attrp);
+  if (s != 0) {
     syslog(LOG_ERR, "Failed to create timestamp thread");
     cleanup_and_exit();
     return -1;
   }
   timestamp_thread_started = 1;
 
+  int next_listener = 0;
   while (!caught_signal) {
+    /* Wake up periodically so threads of timed out clients get reaped even
+     * when no new connection arrives */
+    int ready = poll(listen_fds, num_listeners, REAP_INTERVAL_MS);
+    if (ready <= 0) {
+      reap_completed_threads();
+      continue;
+    }
+
+    /* Serve one ready listener per pass, round robin so a busy endpoint
+     * cannot starve the others */
+    int listener_fd = -1;
+    for (int i = 0; i < num_listeners && listener_fd == -1; i++) {
+      int idx = (next_listener + i) % num_listeners;
+      if (listen_fds[idx].revents & POLLIN) {
+        listener_fd = listen_fds[idx].fd;
+        next_listener = idx + 1;
+      }
+    }
+    if (listener_fd == -1)
+      continue;
+
+    client_addr_len = sizeof(client_addr);
     int client_fd =
-        accept(server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
+        accept(listener_fd, (struct sockaddr *)&client_addr, &client_addr_len);
 
     if (client_fd == -1) {
       if (errno == EINTR) {
@@ -426,8 +1856,8 @@ int main(int argc, char *argv[]) {
       continue;
     }
 
-    char client_ip[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+    char client_ip[PEER_NAME_SIZE];
+    format_peer(&client_addr, client_ip, sizeof(client_ip));
 
     syslog(LOG_INFO, "Accepted connection from %s", client_ip);
 
@@ -439,11 +1869,16 @@ int main(int argc, char *argv[]) {
     }
 
     new_thread_data->client_fd = client_fd;
-    strncpy(new_thread_data->client_ip, client_ip, INET_ADDRSTRLEN);
-    new_thread_data->thread_complete_flag = 0;
-
-    if (pthread_create(&new_thread_data->thread_id, NULL, thread_func,
-                       new_thread_data) != 0) {
+    strncpy(new_thread_data->client_ip, client_ip, PEER_NAME_SIZE);
+    atomic_init(&new_thread_data->thread_complete_flag, 0);
+
+    attrp = placement_attr(&attr, &cpu_placement.workers,
+                           cpu_placement.workers_set);
+    s = pthread_create(&new_thread_data->thread_id, attrp, thread_func,
+                       new_thread_data);
+    if (attrp != NULL)
+      pthread_attr_destroy(attrp);
+    if (s != 0) {
       syslog(LOG_ERR, "Failed to create thread");
       free(new_thread_data);
       close(client_fd);
@@ -452,19 +1887,7 @@ int main(int argc, char *argv[]) {
 
     SLIST_INSERT_HEAD(&head, new_thread_data, entries);
 
-    // Check for completed threads
-    struct thread_data *datap = NULL;
-    struct thread_data *tmp = NULL;
-    datap = SLIST_FIRST(&head);
-    while (datap != NULL) {
-      tmp = SLIST_NEXT(datap, entries);
-      if (datap->thread_complete_flag) {
-        pthread_join(datap->thread_id, NULL);
-        SLIST_REMOVE(&head, datap, thread_data, entries);
-        free(datap);
-      }
-      datap = tmp;
-    }
+    reap_completed_threads();
   }
 
   // Wait for timestamp thread
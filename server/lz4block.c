@@ -0,0 +1,152 @@
+#include "lz4block.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 4
+/* The format requires the last match to start 12 bytes before the end and
+ * the last 5 bytes to be literals */
+#define MF_LIMIT 12
+#define LAST_LITERALS 5
+#define MAX_OFFSET 65535
+#define HASH_LOG 12
+
+static uint32_t read32(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t hash32(uint32_t v) {
+  return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static char *write_length(char *op, size_t len) {
+  while (len >= 255) {
+    *op++ = (char)255;
+    len -= 255;
+  }
+  *op++ = (char)len;
+  return op;
+}
+
+static char *write_sequence(char *op, const char *literals,
+                            size_t literal_len, size_t offset,
+                            size_t match_len) {
+  char *token = op++;
+  unsigned char t = (literal_len >= 15 ? 15 : literal_len) << 4;
+
+  if (literal_len >= 15)
+    op = write_length(op, literal_len - 15);
+  memcpy(op, literals, literal_len);
+  op += literal_len;
+
+  if (match_len > 0) {
+    size_t ml = match_len - MIN_MATCH;
+    *op++ = (char)(offset & 0xff);
+    *op++ = (char)(offset >> 8);
+    t |= ml >= 15 ? 15 : ml;
+    if (ml >= 15)
+      op = write_length(op, ml - 15);
+  }
+
+  *token = (char)t;
+  return op;
+}
+
+size_t lz4block_compress(const char *src, size_t src_len, char *dst) {
+  uint32_t table[1 << HASH_LOG];
+  const char *ip = src;
+  const char *anchor = src;
+  const char *end = src + src_len;
+  char *op = dst;
+
+  if (src_len >= MF_LIMIT + 1) {
+    const char *match_limit = end - MF_LIMIT;
+    const char *copy_limit = end - LAST_LITERALS;
+
+    memset(table, 0, sizeof(table));
+    while (ip < match_limit) {
+      uint32_t seq = read32(ip);
+      uint32_t h = hash32(seq);
+      const char *ref = src + table[h];
+      table[h] = ip - src;
+
+      if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+        ip++;
+        continue;
+      }
+
+      const char *mp = ip + MIN_MATCH;
+      const char *rp = ref + MIN_MATCH;
+      while (mp < copy_limit && *mp == *rp) {
+        mp++;
+        rp++;
+      }
+
+      op = write_sequence(op, anchor, ip - anchor, ip - ref, mp - ip);
+      ip = anchor = mp;
+    }
+  }
+
+  return write_sequence(op, anchor, end - anchor, 0, 0) - dst;
+}
+
+static int read_length(const unsigned char **ip, const unsigned char *end,
+                       size_t *len) {
+  unsigned char b;
+  do {
+    if (*ip >= end)
+      return -1;
+    b = *(*ip)++;
+    *len += b;
+  } while (b == 255);
+  return 0;
+}
+
+long lz4block_decompress(const char *src, size_t src_len, char *dst,
+                         size_t dst_capacity) {
+  const unsigned char *ip = (const unsigned char *)src;
+  const unsigned char *end = ip + src_len;
+  char *op = dst;
+  char *op_end = dst + dst_capacity;
+
+  while (ip < end) {
+    unsigned char token = *ip++;
+    size_t literal_len = token >> 4;
+
+    if (literal_len == 15 && read_length(&ip, end, &literal_len) == -1)
+      return -1;
+    if (literal_len > (size_t)(end - ip) ||
+        literal_len > (size_t)(op_end - op))
+      return -1;
+    memcpy(op, ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+
+    /* Last sequence has no match part */
+    if (ip == end)
+      break;
+
+    if (end - ip < 2)
+      return -1;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (size_t)(op - dst))
+      return -1;
+
+    size_t match_len = token & 15;
+    if (match_len == 15 && read_length(&ip, end, &match_len) == -1)
+      return -1;
+    match_len += MIN_MATCH;
+    if (match_len > (size_t)(op_end - op))
+      return -1;
+
+    /* Byte copy, matches may overlap the output */
+    const char *ref = op - offset;
+    while (match_len--)
+      *op++ = *ref++;
+  }
+
+  return op - dst;
+}
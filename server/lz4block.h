@@ -0,0 +1,27 @@
+#ifndef LZ4BLOCK_H
+#define LZ4BLOCK_H
+
+#include <stddef.h>
+
+/*
+ * Minimal built-in encoder/decoder for the LZ4 block format, so replies can be
+ * decoded by any LZ4 implementation (LZ4_decompress_safe) on the client side.
+ */
+
+/* Worst case compressed size for an input of len bytes */
+#define LZ4BLOCK_BOUND(len) ((len) + (len) / 255 + 16)
+
+/**
+ * Compress src_len bytes of src into dst, which must hold at least
+ * LZ4BLOCK_BOUND(src_len) bytes. Returns the compressed size.
+ */
+size_t lz4block_compress(const char *src, size_t src_len, char *dst);
+
+/**
+ * Decompress an LZ4 block of src_len bytes into dst, writing at most
+ * dst_capacity bytes. Returns the decompressed size or -1 on malformed input.
+ */
+long lz4block_decompress(const char *src, size_t src_len, char *dst,
+                         size_t dst_capacity);
+
+#endif /* LZ4BLOCK_H */
@@ -0,0 +1,61 @@
+#!/bin/bash
+# Start a fresh aesdsocket and run aesdsocket-stress against it
+# Usage: stress-test.sh [plain|tsan|valgrind] [aesdsocket-stress options]
+# Extra server options can be passed in AESDSOCKET_ARGS.
+
+cd `dirname $0`
+
+mode=${1:-plain}
+shift
+
+case "$mode" in
+    plain)
+        server="./aesdsocket"
+        ;;
+    tsan)
+        export TSAN_OPTIONS="halt_on_error=1 exitcode=66 second_deadlock_stack=1"
+        server="./aesdsocket-tsan"
+        ;;
+    valgrind)
+        server="valgrind --error-exitcode=1 --leak-check=full --show-leak-kinds=all --track-origins=yes --errors-for-leak-kinds=definite --log-file=valgrind-stress-out.txt ./aesdsocket"
+        ;;
+    *)
+        echo "Usage: $0 [plain|tsan|valgrind] [aesdsocket-stress options]"
+        exit 1
+        ;;
+esac
+
+rm -f /var/tmp/aesdsocketdata /var/tmp/aesdsocketdata.idx
+
+$server $AESDSOCKET_ARGS &
+server_pid=$!
+
+# Wait for the listener, valgrind can take a while to start
+unix_path=`echo "$AESDSOCKET_ARGS" | sed -n 's/.*-l *unix:\([^ ]*\).*/\1/p'`
+for i in $(seq 100); do
+    if [ -n "$unix_path" ]; then
+        if [ -S "$unix_path" ]; then
+            break
+        fi
+    elif (exec 3<>/dev/tcp/127.0.0.1/9000) 2>/dev/null; then
+        break
+    fi
+    if ! kill -0 $server_pid 2>/dev/null; then
+        echo "Server exited before listening"
+        exit 1
+    fi
+    sleep 0.2
+done
+
+./aesdsocket-stress "$@"
+stress_rc=$?
+
+kill -TERM $server_pid
+wait $server_pid
+server_rc=$?
+
+if [ $server_rc -ne 0 ]; then
+    echo "Server ($mode) exited with rc=${server_rc}"
+    exit $server_rc
+fi
+exit $stress_rc
@@ -0,0 +1,179 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "../../examples/threading/threading.h"
+
+#define NUM_WORKERS 4
+#define BATCH_SIZE 64
+
+static struct threadpool *pool;
+static atomic_int callback_count;
+static atomic_long callback_sum;
+
+static void *square(void *arg)
+{
+    intptr_t value = (intptr_t) arg;
+    return (void *) (value * value);
+}
+
+static void count_callback(void *result, void *callback_arg)
+{
+    (void) callback_arg;
+    atomic_fetch_add(&callback_sum, (long) (intptr_t) result);
+    atomic_fetch_add(&callback_count, 1);
+}
+
+/* Runs on a worker: submits a subtask and waits on it from inside the pool */
+static void *nested_square(void *arg)
+{
+    struct threadpool_task *task = threadpool_submit(pool, square, arg);
+    if (task == NULL) {
+        return (void *) (intptr_t) -1;
+    }
+    void *result = threadpool_future_get(task);
+    threadpool_future_release(task);
+    return result;
+}
+
+static void *slow_square(void *arg)
+{
+    usleep(20000);
+    return square(arg);
+}
+
+/* Runs on a worker: waits on a slow subtask another worker has taken */
+static void *wait_on_stolen(void *arg)
+{
+    struct threadpool_task *task = threadpool_submit(pool, slow_square, arg);
+    if (task == NULL) {
+        return (void *) (intptr_t) -1;
+    }
+    usleep(5000);
+    void *result = threadpool_future_get(task);
+    threadpool_future_release(task);
+    return result;
+}
+
+/**
+* Submit a batch of tasks and check every future returns its own result
+*/
+void test_threadpool_batch_futures()
+{
+    pool = threadpool_create(NUM_WORKERS);
+    TEST_ASSERT_NOT_NULL_MESSAGE(pool, "Could not create thread pool");
+
+    void *args[BATCH_SIZE];
+    struct threadpool_task *futures[BATCH_SIZE];
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        args[i] = (void *) (intptr_t) i;
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(BATCH_SIZE,
+            threadpool_submit_batch(pool, square, args, BATCH_SIZE, futures),
+            "Not every task of the batch was queued");
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(i * i, (intptr_t) threadpool_future_get(futures[i]),
+                "Wrong result from batch future");
+        threadpool_future_release(futures[i]);
+    }
+    threadpool_destroy(pool);
+}
+
+/**
+* Tasks which submit and wait on subtasks must not deadlock, even with more
+* waiting tasks than workers
+*/
+void test_threadpool_nested_submit()
+{
+    pool = threadpool_create(NUM_WORKERS);
+    TEST_ASSERT_NOT_NULL_MESSAGE(pool, "Could not create thread pool");
+
+    void *args[BATCH_SIZE];
+    struct threadpool_task *futures[BATCH_SIZE];
+
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        args[i] = (void *) (intptr_t) i;
+    }
+    TEST_ASSERT_EQUAL_INT(BATCH_SIZE,
+            threadpool_submit_batch(pool, nested_square, args, BATCH_SIZE, futures));
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(i * i, (intptr_t) threadpool_future_get(futures[i]),
+                "Wrong result from nested task");
+        threadpool_future_release(futures[i]);
+    }
+    threadpool_destroy(pool);
+}
+
+/**
+* A worker waiting on a subtask that another worker is running sleeps until
+* it completes, and still wakes up for new work in the meantime
+*/
+void test_threadpool_wait_on_running_task()
+{
+    pool = threadpool_create(2);
+    TEST_ASSERT_NOT_NULL_MESSAGE(pool, "Could not create thread pool");
+
+    struct threadpool_task *waiting = threadpool_submit(pool, wait_on_stolen, (void *) 3);
+    TEST_ASSERT_NOT_NULL(waiting);
+    usleep(10000);
+    struct threadpool_task *later = threadpool_submit(pool, square, (void *) 5);
+    TEST_ASSERT_NOT_NULL(later);
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(25, (intptr_t) threadpool_future_get(later),
+            "Task submitted while a worker waited did not run");
+    TEST_ASSERT_EQUAL_INT_MESSAGE(9, (intptr_t) threadpool_future_get(waiting),
+            "Wrong result from waiting task");
+    threadpool_future_release(later);
+    threadpool_future_release(waiting);
+    threadpool_destroy(pool);
+}
+
+/**
+* The mutex task runs threadfunc on the pool with its thread_data held in the
+* pooled descriptor
+*/
+void test_threadpool_obtaining_mutex()
+{
+    pool = threadpool_create(NUM_WORKERS);
+    TEST_ASSERT_NOT_NULL_MESSAGE(pool, "Could not create thread pool");
+
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct threadpool_task *task = threadpool_submit_obtaining_mutex(pool, &mutex, 1, 1);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(task, "Could not queue mutex task");
+    struct thread_data *data = (struct thread_data *) threadpool_future_get(task);
+    TEST_ASSERT_TRUE_MESSAGE(data->thread_complete_success, "Mutex task failed");
+    TEST_ASSERT_EQUAL_INT(0, pthread_mutex_trylock(&mutex));
+    pthread_mutex_unlock(&mutex);
+    threadpool_future_release(task);
+    threadpool_destroy(pool);
+}
+
+/**
+* Callbacks run for every task, and threadpool_destroy() runs all queued
+* tasks before it returns
+*/
+void test_threadpool_callbacks_and_destroy()
+{
+    pool = threadpool_create(NUM_WORKERS);
+    TEST_ASSERT_NOT_NULL_MESSAGE(pool, "Could not create thread pool");
+
+    long expected = 0;
+
+    atomic_store(&callback_count, 0);
+    atomic_store(&callback_sum, 0);
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        TEST_ASSERT_TRUE(threadpool_submit_callback(pool, square, (void *) (intptr_t) i,
+                    count_callback, NULL));
+        expected += i * i;
+    }
+
+    threadpool_destroy(pool);
+    pool = NULL;
+
+    TEST_ASSERT_EQUAL_INT_MESSAGE(BATCH_SIZE, atomic_load(&callback_count),
+            "Destroy returned before every callback ran");
+    TEST_ASSERT_EQUAL_INT(expected, atomic_load(&callback_sum));
+}